@@ -0,0 +1,399 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <stdexcept>
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <new>
+#include <thread>
+
+// 多线程往同一块连续内存里追加数据的碰撞分配器：栈顶是原子变量，用fetch_add推进，不加锁。
+// 分配出的内存按"块"组织，每块开头有块头，块内每条记录前有记录头，
+// 所以整块缓冲区可以从头到尾按分配顺序遍历
+class ConcurrentBumpAllocator {
+public:
+    // 块的起点都按这个对齐，块头和记录头因此天然对齐
+    static const size_t CHUNK_ALIGNMENT = alignof(std::max_align_t);
+
+    struct ChunkHeader {
+        // 块里已经写完的字节数，块交回时用release写入；遍历时只看这个数以内的记录
+        std::atomic<uint32_t> used;
+        uint32_t capacity;
+    };
+
+    struct RecordHeader {
+        uint32_t size;
+        uint32_t padding;   // 记录头末尾到数据开头的对齐填充
+    };
+
+    explicit ConcurrentBumpAllocator(size_t size)
+        : m_totalSize(size), m_currentOffset(0){
+        m_startPtr=static_cast<char*>(std::aligned_alloc(CHUNK_ALIGNMENT, roundUp(size, CHUNK_ALIGNMENT)));
+        if(!m_startPtr){
+            throw std::bad_alloc();
+        }
+    }
+    ~ConcurrentBumpAllocator(){
+        free(m_startPtr);
+    }
+    ConcurrentBumpAllocator(const ConcurrentBumpAllocator&) = delete;
+    ConcurrentBumpAllocator& operator=(const ConcurrentBumpAllocator&) = delete;
+
+    // 从共享栈顶划出一个能装下payload字节的块。
+    // fetch_add越过末尾时抛bad_alloc，栈顶停在末尾之后，之后的分配也都会失败，直到reset。
+    // 越界的那一块起点如果还在末尾之前，[offset, 末尾)只归它所有，放一个空块头让遍历跳过
+    ChunkHeader* reserveChunk(size_t payload){
+        size_t bytes = roundUp(sizeof(ChunkHeader)+payload, CHUNK_ALIGNMENT);
+        size_t offset = m_currentOffset.fetch_add(bytes, std::memory_order_relaxed);
+        if(offset+bytes>m_totalSize){
+            if(offset<m_totalSize){
+                ChunkHeader* filler = new (m_startPtr+offset) ChunkHeader{};
+                filler->capacity=static_cast<uint32_t>(roundUp(m_totalSize, CHUNK_ALIGNMENT)-offset-sizeof(ChunkHeader));
+                filler->used.store(0, std::memory_order_release);
+            }
+            throw std::bad_alloc();
+        }
+        ChunkHeader* chunk = new (m_startPtr+offset) ChunkHeader{};
+        chunk->capacity=static_cast<uint32_t>(bytes-sizeof(ChunkHeader));
+        return chunk;
+    }
+
+    // 直接从共享栈顶分配一条记录，每次都要一次fetch_add，竞争激烈时用BumpCursor
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)){
+        ChunkHeader* chunk = reserveChunk(sizeof(RecordHeader)+alignment-1+size);
+        uint32_t used = 0;
+        void* ptr = placeRecord(chunk, used, size, alignment);
+        chunk->used.store(used, std::memory_order_release);
+        return ptr;
+    }
+
+    // 在块内used处放一条记录，放不下返回nullptr，used推进到记录末尾
+    static void* placeRecord(ChunkHeader* chunk, uint32_t& used, size_t size, size_t alignment){
+        char* data = reinterpret_cast<char*>(chunk+1);
+        char* payload = data+used+sizeof(RecordHeader);
+        size_t padding = alignAdjustment(payload, alignment);
+        size_t end = used+sizeof(RecordHeader)+padding+size;
+        end = roundUp(end, alignof(RecordHeader));
+        if(end>chunk->capacity){
+            return nullptr;
+        }
+        RecordHeader* record = reinterpret_cast<RecordHeader*>(data+used);
+        record->size=static_cast<uint32_t>(size);
+        record->padding=static_cast<uint32_t>(padding);
+        used=static_cast<uint32_t>(end);
+        return payload+padding;
+    }
+
+    // 按分配顺序遍历所有记录：块按划出的先后，块内按写入的先后。
+    // 只保证看到已交回的块，所以要在生产者线程结束或flush之后调用
+    template<typename Fn>
+    void forEach(Fn&& fn) const {
+        size_t end = std::min(m_currentOffset.load(std::memory_order_acquire), m_totalSize);
+        size_t offset = 0;
+        while(offset<end){
+            const ChunkHeader* chunk = reinterpret_cast<const ChunkHeader*>(m_startPtr+offset);
+            const char* data = reinterpret_cast<const char*>(chunk+1);
+            uint32_t used = chunk->used.load(std::memory_order_acquire);
+            uint32_t pos = 0;
+            while(pos<used){
+                const RecordHeader* record = reinterpret_cast<const RecordHeader*>(data+pos);
+                const char* payload = data+pos+sizeof(RecordHeader)+record->padding;
+                fn(static_cast<const void*>(payload), static_cast<size_t>(record->size));
+                pos=static_cast<uint32_t>(roundUp(pos+sizeof(RecordHeader)+record->padding+record->size, alignof(RecordHeader)));
+            }
+            offset+=sizeof(ChunkHeader)+chunk->capacity;
+        }
+    }
+
+    // 不能和分配并发调用
+    void reset(){
+        m_currentOffset.store(0, std::memory_order_relaxed);
+    }
+
+    size_t used() const {
+        return std::min(m_currentOffset.load(std::memory_order_relaxed), m_totalSize);
+    }
+
+    size_t capacity() const {
+        return m_totalSize;
+    }
+
+    static size_t alignAdjustment(const void* ptr, size_t alignment){
+        size_t mask = alignment-1;
+        size_t misalignment = reinterpret_cast<size_t>(ptr) & mask;
+        return misalignment ? alignment - misalignment : 0;
+    }
+
+    static size_t roundUp(size_t value, size_t alignment){
+        return (value+alignment-1) & ~(alignment-1);
+    }
+
+private:
+    char* m_startPtr;
+    size_t m_totalSize;
+    std::atomic<size_t> m_currentOffset;
+};
+
+// 每个线程一个游标：一次从共享栈顶拿一整块(默认64KB)，块内本地碰撞，不碰原子变量。
+// 块用完或析构时把已用字节数交回；大于块四分之一的分配直接走共享路径，免得浪费块尾。
+// 走共享路径前先交回当前块，之后的小分配另开新块，遍历顺序才和分配顺序一致
+class BumpCursor {
+public:
+    static const size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+    explicit BumpCursor(ConcurrentBumpAllocator& allocator, size_t blockSize = DEFAULT_BLOCK_SIZE)
+        : m_allocator(allocator), m_blockSize(blockSize), m_chunk(nullptr), m_used(0), m_chunkCount(0){}
+
+    ~BumpCursor(){
+        flush();
+    }
+    BumpCursor(const BumpCursor&) = delete;
+    BumpCursor& operator=(const BumpCursor&) = delete;
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)){
+        if(size+alignment>m_blockSize/4){
+            flush();
+            return m_allocator.allocate(size, alignment);
+        }
+        if(m_chunk){
+            void* ptr = ConcurrentBumpAllocator::placeRecord(m_chunk, m_used, size, alignment);
+            if(ptr){
+                return ptr;
+            }
+            flush();
+        }
+        m_chunk=m_allocator.reserveChunk(m_blockSize-sizeof(ConcurrentBumpAllocator::ChunkHeader));
+        ++m_chunkCount;
+        return ConcurrentBumpAllocator::placeRecord(m_chunk, m_used, size, alignment);
+    }
+
+    // 交回当前块，块尾没用完的部分遍历时直接跳过
+    void flush(){
+        if(m_chunk){
+            m_chunk->used.store(m_used, std::memory_order_release);
+            m_chunk=nullptr;
+            m_used=0;
+        }
+    }
+
+    size_t chunkCount() const {
+        return m_chunkCount;
+    }
+
+private:
+    ConcurrentBumpAllocator& m_allocator;
+    size_t m_blockSize;
+    ConcurrentBumpAllocator::ChunkHeader* m_chunk;
+    uint32_t m_used;
+    size_t m_chunkCount;
+};
+
+// 工作线程产生的粒子事件
+struct alignas(16) ParticleEvent {
+    uint32_t thread;
+    uint32_t sequence;
+    float position[2];
+    float velocity[2];
+};
+
+// 偶尔夹在事件中间的大记录，超过块的四分之一，走共享路径
+struct ParticleBurst {
+    ParticleEvent head;
+    float samples[5120];
+};
+
+// 对照组：StackAllocator那样的单线程分配，外面套一把锁
+class LockedStackAllocator {
+public:
+    explicit LockedStackAllocator(size_t size)
+        : m_totalSize(size), m_currentOffset(0){
+        m_startPtr=static_cast<char*>(malloc(size));
+        if(!m_startPtr){
+            throw std::bad_alloc();
+        }
+    }
+    ~LockedStackAllocator(){
+        free(m_startPtr);
+    }
+    LockedStackAllocator(const LockedStackAllocator&) = delete;
+    LockedStackAllocator& operator=(const LockedStackAllocator&) = delete;
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)){
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t adjustment = ConcurrentBumpAllocator::alignAdjustment(m_startPtr+m_currentOffset,alignment);
+        if(m_currentOffset+adjustment+size>m_totalSize){
+            throw std::bad_alloc();
+        }
+        void* alignedPtr = m_startPtr+m_currentOffset+adjustment;
+        m_currentOffset+=adjustment+size;
+        return alignedPtr;
+    }
+
+    size_t used() const {
+        return m_currentOffset;
+    }
+
+private:
+    std::mutex m_mutex;
+    char* m_startPtr;
+    size_t m_totalSize;
+    size_t m_currentOffset;
+};
+
+void fillEvent(void* memory, uint32_t thread, uint32_t sequence){
+    new (memory) ParticleEvent{thread, sequence,
+        {static_cast<float>(sequence % 640), static_cast<float>(thread * 10)},
+        {1.0f, -static_cast<float>(sequence % 7)}};
+}
+
+// 每个线程各开一个，全部就绪后同时开跑，返回毫秒
+template<typename Work>
+double runThreads(int threadCount, Work work){
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for(int t=0;t<threadCount;++t){
+        threads.emplace_back([&, t](){
+            ready.fetch_add(1);
+            while(!go.load(std::memory_order_acquire)){
+                std::this_thread::yield();
+            }
+            work(static_cast<uint32_t>(t));
+        });
+    }
+    while(ready.load()<threadCount){
+        std::this_thread::yield();
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for(auto& th : threads){
+        th.join();
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count();
+}
+
+// 遍历检查：条数对得上，每个线程自己的序号严格递增(分配顺序保留了下来)。
+// 记录可以是单个事件，也可以是以事件开头的大记录
+bool verifyOrder(const ConcurrentBumpAllocator& allocator, int threadCount, size_t perThread, size_t& visited){
+    std::vector<int64_t> last(threadCount, -1);
+    bool ordered = true;
+    visited = 0;
+    allocator.forEach([&](const void* ptr, size_t size){
+        bool known = size==sizeof(ParticleEvent) || size==sizeof(ParticleBurst);
+        if(!known || reinterpret_cast<uintptr_t>(ptr) % alignof(ParticleEvent)){
+            ordered = false;
+            return;
+        }
+        const ParticleEvent* e = static_cast<const ParticleEvent*>(ptr);
+        if(static_cast<int64_t>(e->sequence)<=last[e->thread]){
+            ordered = false;
+        }
+        last[e->thread] = e->sequence;
+        ++visited;
+    });
+    return ordered && visited==threadCount*perThread;
+}
+
+void runContentionTest(){
+    const int THREADS = 32;
+    const size_t EVENTS_PER_THREAD = 20000;
+    const size_t BURST_INTERVAL = 1000;
+    const size_t BURSTS_PER_THREAD = EVENTS_PER_THREAD / BURST_INTERVAL;
+    const size_t recordBytes = sizeof(ConcurrentBumpAllocator::RecordHeader)+sizeof(ParticleEvent)+alignof(ParticleEvent);
+    const size_t burstBytes = sizeof(ConcurrentBumpAllocator::ChunkHeader)+sizeof(ConcurrentBumpAllocator::RecordHeader)
+                              +sizeof(ParticleBurst)+alignof(ParticleBurst)+16;
+    const size_t BUFFER_SIZE = THREADS*EVENTS_PER_THREAD*(recordBytes+sizeof(ConcurrentBumpAllocator::ChunkHeader)+16)
+                               + THREADS*BURSTS_PER_THREAD*(burstBytes+BumpCursor::DEFAULT_BLOCK_SIZE)
+                               + THREADS*BumpCursor::DEFAULT_BLOCK_SIZE;
+    std::cout << "并发碰撞分配：" << THREADS << " 线程，每线程 " << EVENTS_PER_THREAD
+              << " 个事件，缓冲区 " << (BUFFER_SIZE / 1024) << " KB\n";
+
+    LockedStackAllocator locked(BUFFER_SIZE);
+    double lockedMs = runThreads(THREADS, [&](uint32_t t){
+        for(size_t i=0;i<EVENTS_PER_THREAD;++i){
+            fillEvent(locked.allocate(sizeof(ParticleEvent), alignof(ParticleEvent)), t, static_cast<uint32_t>(i));
+        }
+    });
+    std::cout << "  加锁栈分配器:     " << std::setw(8) << std::fixed << std::setprecision(2) << lockedMs
+              << " ms，用了 " << (locked.used() / 1024) << " KB\n";
+
+    ConcurrentBumpAllocator shared(BUFFER_SIZE);
+    double sharedMs = runThreads(THREADS, [&](uint32_t t){
+        for(size_t i=0;i<EVENTS_PER_THREAD;++i){
+            fillEvent(shared.allocate(sizeof(ParticleEvent), alignof(ParticleEvent)), t, static_cast<uint32_t>(i));
+        }
+    });
+    size_t visited = 0;
+    bool ok = verifyOrder(shared, THREADS, EVENTS_PER_THREAD, visited);
+    std::cout << "  每次fetch_add:    " << std::setw(8) << sharedMs << " ms，用了 " << (shared.used() / 1024)
+              << " KB，遍历 " << visited << " 条" << (ok ? "，顺序正确" : "，顺序错误") << "\n";
+
+    // 每BURST_INTERVAL个事件夹一条大记录，检查大小混合时顺序也不乱
+    ConcurrentBumpAllocator blocks(BUFFER_SIZE);
+    std::atomic<size_t> chunks(0);
+    double blockMs = runThreads(THREADS, [&](uint32_t t){
+        BumpCursor cursor(blocks);
+        uint32_t sequence = 0;
+        for(size_t i=0;i<EVENTS_PER_THREAD;++i){
+            if(i%BURST_INTERVAL==BURST_INTERVAL/2){
+                ParticleBurst* burst = static_cast<ParticleBurst*>(cursor.allocate(sizeof(ParticleBurst), alignof(ParticleBurst)));
+                fillEvent(&burst->head, t, sequence++);
+            }
+            fillEvent(cursor.allocate(sizeof(ParticleEvent), alignof(ParticleEvent)), t, sequence++);
+        }
+        chunks.fetch_add(cursor.chunkCount());
+    });
+    ok = verifyOrder(blocks, THREADS, EVENTS_PER_THREAD+BURSTS_PER_THREAD, visited);
+    std::cout << "  64KB线程本地块:   " << std::setw(8) << blockMs << " ms，用了 " << (blocks.used() / 1024)
+              << " KB，共 " << chunks.load() << " 个块 + " << THREADS*BURSTS_PER_THREAD
+              << " 条大记录，遍历 " << visited << " 条"
+              << (ok ? "，顺序正确" : "，顺序错误") << "\n";
+}
+
+int main() {
+    ConcurrentBumpAllocator allocator(4096);
+    int* arr = static_cast<int*>(allocator.allocate(10 * sizeof(int), 16));
+    arr[0] = 1;
+    struct alignas(64) BigStruct {
+        double data[8];
+    };
+    BigStruct* big = static_cast<BigStruct*>(allocator.allocate(sizeof(BigStruct), 64));
+    big->data[0] = 2.0;
+    size_t records = 0;
+    allocator.forEach([&](const void* ptr, size_t size){
+        std::cout << "记录 " << records++ << ": " << size << " 字节，对齐到64: "
+                  << (reinterpret_cast<uintptr_t>(ptr) % 64 == 0 ? "是" : "否") << "\n";
+    });
+    try {
+        allocator.allocate(8192);
+    } catch (const std::bad_alloc&) {
+        std::cout << "超出容量时分配失败\n";
+    }
+    allocator.reset();
+
+    // 同一个游标上小、大、小交替分配，遍历出来应该是 1 2 3
+    {
+        ConcurrentBumpAllocator mixed(256 * 1024);
+        {
+            BumpCursor cursor(mixed);
+            fillEvent(cursor.allocate(sizeof(ParticleEvent), alignof(ParticleEvent)), 0, 1);
+            ParticleBurst* burst = static_cast<ParticleBurst*>(cursor.allocate(sizeof(ParticleBurst), alignof(ParticleBurst)));
+            fillEvent(&burst->head, 0, 2);
+            fillEvent(cursor.allocate(sizeof(ParticleEvent), alignof(ParticleEvent)), 0, 3);
+        }
+        std::cout << "大小混合分配的遍历顺序:";
+        mixed.forEach([](const void* ptr, size_t){
+            std::cout << " " << static_cast<const ParticleEvent*>(ptr)->sequence;
+        });
+        std::cout << "\n";
+    }
+
+    runContentionTest();
+
+    return 0;
+}
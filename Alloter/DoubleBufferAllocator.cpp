@@ -11,75 +11,8 @@
 #include <atomic>
 #include <numeric>
 
-class StackAllocator {
-public:
-   explicit StackAllocator(size_t size)
-        : m_totalSize(size), m_currentOffset(0){
-        m_startPtr=static_cast<char*>(malloc(size));
-        if(!m_startPtr){
-            throw std::bad_alloc();
-        }    
-    }
-    ~StackAllocator(){
-        free(m_startPtr);
-    }
-    StackAllocator(const StackAllocator&) = delete;
-    StackAllocator& operator=(const StackAllocator&) = delete;
-
-    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)){
-        size_t adjustment = alignAdjustment(m_startPtr+m_currentOffset,alignment);
-        if(m_currentOffset+adjustment+size>m_totalSize){
-            throw std::bad_alloc();
-        }
-        void* alignedPtr = m_startPtr+m_currentOffset+adjustment;
-        m_currentOffset+=adjustment+size;
-        return alignedPtr;
-    }
-
-    void reset(){
-        m_currentOffset=0;
-    }
-
-    size_t used() const {
-        return m_currentOffset;
-    }
-
-    size_t capacity() const {
-        return m_totalSize;
-    }
-
-    void* getStart(){
-        return m_startPtr;
-    }
-
-    static size_t alignAdjustment(const void* ptr, size_t alignment){
-        size_t mask = alignment-1;
-        size_t misalignment = reinterpret_cast<size_t>(ptr) & mask;
-        return misalignment ? alignment - misalignment : 0;
-    }
-
-private:
-    char* m_startPtr;
-    size_t m_totalSize;
-    size_t m_currentOffset;
-};
-
-class DoubleBufferAllocator {
-    public:
-        explicit DoubleBufferAllocator(size_t size) : m_size(size){
-            m_buffers[0] = std::make_unique<char[]>(size);
-            m_buffers[1] = std::make_unique<char[]>(size);
-        }
-        void* front() const {return m_buffers[m_front].get();}
-        void* back() const {return m_buffers[1-m_front].get();}
-        void swap() {
-            m_front.store(1-m_front.load());
-        }
-    private:
-        std::array<std::unique_ptr<char[]>,2> m_buffers;
-        std::atomic<uint8_t> m_front{0};
-        size_t m_size;
-};
+#include "DoubleBufferAllocator.h"
+#include "StackAllocator.h"
 
 struct alignas(32) Particle {
     float position[2];
@@ -0,0 +1,28 @@
+#pragma once
+
+// 双缓冲帧内存：两块等长缓冲，交换只是翻转front下标。
+// Alloter下的示例和ECS的事件通道共用这一份
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+class DoubleBufferAllocator {
+    public:
+        explicit DoubleBufferAllocator(size_t size) : m_size(size){
+            m_buffers[0] = std::make_unique<char[]>(size);
+            m_buffers[1] = std::make_unique<char[]>(size);
+        }
+        void* front() const {return m_buffers[m_front].get();}
+        void* back() const {return m_buffers[1-m_front].get();}
+        void swap() {
+            m_front.store(1-m_front.load());
+        }
+        size_t size() const {return m_size;}
+    private:
+        std::array<std::unique_ptr<char[]>,2> m_buffers;
+        std::atomic<uint8_t> m_front{0};
+        size_t m_size;
+};
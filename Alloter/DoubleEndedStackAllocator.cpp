@@ -0,0 +1,212 @@
+#include <cstddef>
+#include <cstdlib>
+#include <stdexcept>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+#include <iomanip>
+
+// 双端栈分配器：一整块内存从两头往中间分配。
+// 底端放关卡/世界生命周期的数据，顶端放每帧的临时数据，两端各自有标记和reset。
+// 两种数据共用一块空闲区，不用各按最坏情况预留一块
+class DoubleEndedStackAllocator {
+public:
+    // 底端标记是从开头算的偏移，顶端标记是从末尾算的偏移，两者都只在自己那一端有效
+    using Marker = size_t;
+
+    explicit DoubleEndedStackAllocator(size_t size)
+        : m_totalSize(size), m_bottomOffset(0), m_topOffset(0){
+        m_startPtr=static_cast<char*>(malloc(size));
+        if(!m_startPtr){
+            throw std::bad_alloc();
+        }
+    }
+    ~DoubleEndedStackAllocator(){
+        free(m_startPtr);
+    }
+    DoubleEndedStackAllocator(const DoubleEndedStackAllocator&) = delete;
+    DoubleEndedStackAllocator& operator=(const DoubleEndedStackAllocator&) = delete;
+
+    // 从底端往上分配
+    void* allocateBottom(size_t size, size_t alignment = alignof(std::max_align_t)){
+        char* current = m_startPtr+m_bottomOffset;
+        size_t adjustment = alignAdjustment(current,alignment);
+        if(m_bottomOffset+adjustment+size+m_topOffset>m_totalSize){
+            throw std::bad_alloc();
+        }
+        m_bottomOffset+=adjustment+size;
+        return current+adjustment;
+    }
+
+    // 从顶端往下分配：先让出size字节，再把起点向下对齐
+    void* allocateTop(size_t size, size_t alignment = alignof(std::max_align_t)){
+        if(m_topOffset+size>m_totalSize){
+            throw std::bad_alloc();
+        }
+        uintptr_t end = reinterpret_cast<uintptr_t>(m_startPtr+m_totalSize-m_topOffset);
+        uintptr_t aligned = (end-size) & ~static_cast<uintptr_t>(alignment-1);
+        if(aligned<reinterpret_cast<uintptr_t>(m_startPtr+m_bottomOffset)){
+            throw std::bad_alloc();
+        }
+        m_topOffset = reinterpret_cast<uintptr_t>(m_startPtr+m_totalSize)-aligned;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    Marker getBottomMarker() const {
+        return m_bottomOffset;
+    }
+
+    Marker getTopMarker() const {
+        return m_topOffset;
+    }
+
+    // 只能往回退，标记比当前位置还高说明嵌套顺序乱了
+    void freeBottomToMarker(Marker marker){
+        if(marker>m_bottomOffset){
+            throw std::logic_error("freeBottomToMarker: marker is above the current bottom top");
+        }
+        m_bottomOffset=marker;
+    }
+
+    void freeTopToMarker(Marker marker){
+        if(marker>m_topOffset){
+            throw std::logic_error("freeTopToMarker: marker is below the current top end");
+        }
+        m_topOffset=marker;
+    }
+
+    void resetBottom(){
+        m_bottomOffset=0;
+    }
+
+    void resetTop(){
+        m_topOffset=0;
+    }
+
+    void reset(){
+        m_bottomOffset=0;
+        m_topOffset=0;
+    }
+
+    size_t usedBottom() const {
+        return m_bottomOffset;
+    }
+
+    size_t usedTop() const {
+        return m_topOffset;
+    }
+
+    // 两端中间还剩的字节数
+    size_t available() const {
+        return m_totalSize-m_bottomOffset-m_topOffset;
+    }
+
+    size_t capacity() const {
+        return m_totalSize;
+    }
+
+    static size_t alignAdjustment(const void* ptr, size_t alignment){
+        size_t mask = alignment-1;
+        size_t misalignment = reinterpret_cast<size_t>(ptr) & mask;
+        return misalignment ? alignment - misalignment : 0;
+    }
+
+private:
+    char* m_startPtr;
+    size_t m_totalSize;
+    size_t m_bottomOffset;
+    size_t m_topOffset;
+};
+
+// 关卡数据：加载时从底端分配，整个关卡期间不动
+struct alignas(16) NavCell {
+    float center[2];
+    float cost;
+    uint32_t neighbors;
+};
+
+struct Unit {
+    float position[2];
+    float velocity[2];
+    int health;
+};
+
+// 演示：关卡加载占底端，每帧的寻路候选和排序键占顶端，帧末只reset顶端；
+// 换关卡时整个底端退到关卡开始前的标记
+void runLevelDemo(){
+    const size_t BLOCK_SIZE = 4 * 1024 * 1024;
+    const int FRAMES = 5;
+    DoubleEndedStackAllocator allocator(BLOCK_SIZE);
+    std::cout << "双端栈分配器：总共 " << (allocator.capacity() / 1024) << " KB\n";
+
+    // 常驻数据：整个程序期间都在
+    Unit* units = static_cast<Unit*>(allocator.allocateBottom(sizeof(Unit) * 10000, alignof(Unit)));
+    for(size_t i=0;i<10000;++i){
+        units[i] = Unit{{static_cast<float>(i % 100), static_cast<float>(i / 100)}, {1.0f, 0.0f}, 100};
+    }
+    DoubleEndedStackAllocator::Marker beforeLevel = allocator.getBottomMarker();
+
+    for(int level=0;level<2;++level){
+        size_t cellCount = 20000 + level * 30000;
+        NavCell* cells = static_cast<NavCell*>(allocator.allocateBottom(sizeof(NavCell) * cellCount, alignof(NavCell)));
+        for(size_t i=0;i<cellCount;++i){
+            cells[i] = NavCell{{static_cast<float>(i % 200), static_cast<float>(i / 200)}, 1.0f, 0};
+        }
+        std::cout << "关卡 " << level << ": 导航格 " << cellCount << "，底端占用 "
+                  << (allocator.usedBottom() / 1024) << " KB\n";
+
+        srand(static_cast<unsigned>(level + 1));
+        for(int frame=0;frame<FRAMES;++frame){
+            // 每帧的临时数据：数量随帧变化，用多少拿多少
+            size_t candidates = 1000 + static_cast<size_t>(rand() % 20000);
+            uint32_t* open = static_cast<uint32_t*>(allocator.allocateTop(sizeof(uint32_t) * candidates, alignof(uint32_t)));
+            float* sortKeys = static_cast<float*>(allocator.allocateTop(sizeof(float) * candidates, 64));
+            for(size_t i=0;i<candidates;++i){
+                open[i] = static_cast<uint32_t>(i % cellCount);
+                sortKeys[i] = cells[open[i]].cost + units[i % 10000].position[0];
+            }
+            std::cout << "  帧 " << frame << ": 候选 " << std::setw(5) << candidates
+                      << "，顶端占用 " << std::setw(4) << (allocator.usedTop() / 1024)
+                      << " KB，剩余 " << (allocator.available() / 1024) << " KB\n";
+            allocator.resetTop();
+        }
+
+        // 卸载关卡，常驻的单位数据还在
+        allocator.freeBottomToMarker(beforeLevel);
+    }
+    std::cout << "卸载后底端占用 " << (allocator.usedBottom() / 1024) << " KB，顶端 "
+              << allocator.usedTop() << " 字节\n";
+}
+
+// 和两块独立预留对比：两边都得按各自最坏情况留余量
+void compareWithSeparateBlocks(){
+    const size_t worstLevel = 50000 * sizeof(NavCell) + 10000 * sizeof(Unit);
+    const size_t worstFrame = 21000 * (sizeof(uint32_t) + sizeof(float)) + 64;
+    const size_t typicalLevel = 20000 * sizeof(NavCell) + 10000 * sizeof(Unit);
+    const size_t typicalFrame = 11000 * (sizeof(uint32_t) + sizeof(float));
+    std::cout << "\n分开预留需要 " << ((worstLevel + worstFrame) / 1024) << " KB\n";
+    std::cout << "典型关卡+典型帧只用到 " << ((typicalLevel + typicalFrame) / 1024)
+              << " KB，双端共用时剩下的 " << ((worstLevel + worstFrame - typicalLevel - typicalFrame) / 1024)
+              << " KB 两端都能用\n";
+}
+
+int main() {
+    DoubleEndedStackAllocator allocator(1024);
+    int* low = static_cast<int*>(allocator.allocateBottom(10 * sizeof(int), 16));
+    double* high = static_cast<double*>(allocator.allocateTop(8 * sizeof(double), 64));
+    low[0] = 1;
+    high[0] = 2.0;
+    try {
+        allocator.allocateBottom(1024);
+    } catch (const std::bad_alloc&) {
+        std::cout << "两端相遇时分配失败，剩余 " << allocator.available() << " 字节\n";
+    }
+    allocator.reset();
+
+    runLevelDemo();
+    compareWithSeparateBlocks();
+
+    return 0;
+}
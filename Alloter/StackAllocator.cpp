@@ -1,3 +1,4 @@
+#include <cassert>
 #include <cstddef>
 #include <cstdlib>
 #include <stdexcept>
@@ -8,58 +9,80 @@
 #include <stdexcept>
 #include <ctime>
 #include <iomanip>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
 
-class StackAllocator {
+#include "StackAllocator.h"
+
+// 作用域栈：构造时记下栈顶，析构时按创建的逆序调用登记过的析构函数，再退回栈顶。
+// 作用域可以嵌套，内层必须先于外层结束；内层存活期间不要再从外层分配
+class ScopedStack {
 public:
-   explicit StackAllocator(size_t size)
-        : m_totalSize(size), m_currentOffset(0){
-        m_startPtr=static_cast<char*>(malloc(size));
-        if(!m_startPtr){
-            throw std::bad_alloc();
-        }    
-    }
-    ~StackAllocator(){
-        free(m_startPtr);
-    }
-    StackAllocator(const StackAllocator&) = delete;
-    StackAllocator& operator=(const StackAllocator&) = delete;
+    explicit ScopedStack(StackAllocator& allocator)
+        : m_allocator(allocator), m_rewind(allocator.getMarker()), m_finalizers(nullptr){}
 
-    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)){
-        size_t adjustment = alignAdjustment(m_startPtr+m_currentOffset,alignment);
-        if(m_currentOffset+adjustment+size>m_totalSize){
-            throw std::bad_alloc();
+    ~ScopedStack(){
+        for(Finalizer* f = m_finalizers; f; f = f->next){
+            f->destroy(f->object);
+        }
+        // 析构不能抛异常：标记高于栈顶说明作用域嵌套乱了，调试版断言，发布版不动栈顶
+        assert(m_rewind<=m_allocator.getMarker());
+        if(m_rewind<=m_allocator.getMarker()){
+            m_allocator.freeToMarker(m_rewind);
         }
-        void* alignedPtr = m_startPtr+m_currentOffset+adjustment;
-        m_currentOffset+=adjustment+size;
-        return alignedPtr;
-    }
-
-    void reset(){
-        m_currentOffset=0;
     }
+    ScopedStack(const ScopedStack&) = delete;
+    ScopedStack& operator=(const ScopedStack&) = delete;
 
-    size_t used() const {
-        return m_currentOffset;
+    // 原始内存，不构造也不析构
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)){
+        return m_allocator.allocate(size, alignment);
     }
 
-    size_t capacity() const {
-        return m_totalSize;
+    // 构造一个对象；平凡析构的类型只是挪一下栈顶，其余的顺带在前面放一条析构记录
+    template<typename T, typename... Args>
+    T* create(Args&&... args){
+        if constexpr (std::is_trivially_destructible_v<T>){
+            return new (m_allocator.allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        } else {
+            Finalizer* f = static_cast<Finalizer*>(m_allocator.allocate(sizeof(Finalizer), alignof(Finalizer)));
+            T* object = new (m_allocator.allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            f->destroy = [](void* p){ static_cast<T*>(p)->~T(); };
+            f->object = object;
+            f->next = m_finalizers;
+            m_finalizers = f;
+            return object;
+        }
     }
 
-    void* getStart(){
-        return m_startPtr;
+    // 平凡类型的数组，元素值初始化
+    template<typename T>
+    T* createArray(size_t count){
+        static_assert(std::is_trivially_destructible_v<T>, "arrays in a scope stack must be trivially destructible");
+        T* items = static_cast<T*>(m_allocator.allocate(sizeof(T) * count, alignof(T)));
+        for(size_t i=0;i<count;++i){
+            new (items + i) T();
+        }
+        return items;
     }
 
-    static size_t alignAdjustment(const void* ptr, size_t alignment){
-        size_t mask = alignment-1;
-        size_t misalignment = reinterpret_cast<size_t>(ptr) & mask;
-        return misalignment ? alignment - misalignment : 0;
+    // 本作用域里分配了多少字节
+    size_t used() const {
+        return m_allocator.getMarker() - m_rewind;
     }
 
 private:
-    char* m_startPtr;
-    size_t m_totalSize;
-    size_t m_currentOffset;
+    struct Finalizer {
+        void (*destroy)(void*);
+        void* object;
+        Finalizer* next;
+    };
+
+    StackAllocator& m_allocator;
+    StackAllocator::Marker m_rewind;
+    Finalizer* m_finalizers;
 };
 
 struct alignas(32) Particle {
@@ -206,6 +229,37 @@ void runPerformanceTest() {
     std::cout << "总内存分配: " << (system.totalMemory() / 1024) << " KB\n";
 }
 
+// 演示嵌套作用域：帧级作用域里再开系统级作用域，系统的临时数据先释放，非平凡对象的析构按逆序执行
+struct ScratchLog {
+    std::string name;
+    explicit ScratchLog(std::string n) : name(std::move(n)) {
+        std::cout << "  构造 " << name << "\n";
+    }
+    ~ScratchLog() {
+        std::cout << "  析构 " << name << "\n";
+    }
+};
+
+void runScopeDemo() {
+    StackAllocator allocator(64 * 1024);
+    std::cout << "\n作用域栈演示\n";
+    for (int frame = 0; frame < 2; ++frame) {
+        ScopedStack frameScope(allocator);
+        ScratchLog* frameLog = frameScope.create<ScratchLog>("帧" + std::to_string(frame) + "日志");
+        float* sortKeys = frameScope.createArray<float>(256);
+        sortKeys[0] = 1.0f;
+        {
+            ScopedStack systemScope(allocator);
+            systemScope.create<ScratchLog>("战斗系统候选表");
+            int* candidates = systemScope.createArray<int>(1024);
+            candidates[0] = frame;
+            std::cout << "  系统作用域占用 " << systemScope.used() << " 字节，栈顶 " << allocator.used() << "\n";
+        }
+        std::cout << "  系统作用域结束后栈顶 " << allocator.used() << "，帧日志仍可用: " << frameLog->name << "\n";
+    }
+    std::cout << "帧结束后栈顶 " << allocator.used() << "\n";
+}
+
 int main() {
     StackAllocator allocator(1024 * 1024);
     int* arr = static_cast<int*>(allocator.allocate(10 * sizeof(int),16));
@@ -216,6 +270,7 @@ int main() {
     
     allocator.reset();
 
+    runScopeDemo();
     runPerformanceTest();
 
     return 0;
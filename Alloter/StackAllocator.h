@@ -0,0 +1,77 @@
+#pragma once
+
+// 线性分配器：只往前分配，整体reset或者退回到标记。
+// Alloter下的示例和ECS的帧内存共用这一份
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+class StackAllocator {
+public:
+    // 栈顶位置，freeToMarker回到这里，之后分配的内存一并作废
+    using Marker = size_t;
+
+    explicit StackAllocator(size_t size)
+        : m_totalSize(size), m_currentOffset(0){
+        m_startPtr=static_cast<char*>(malloc(size));
+        if(!m_startPtr){
+            throw std::bad_alloc();
+        }
+    }
+    ~StackAllocator(){
+        free(m_startPtr);
+    }
+    StackAllocator(const StackAllocator&) = delete;
+    StackAllocator& operator=(const StackAllocator&) = delete;
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)){
+        size_t adjustment = alignAdjustment(m_startPtr+m_currentOffset,alignment);
+        if(m_currentOffset+adjustment+size>m_totalSize){
+            throw std::bad_alloc();
+        }
+        void* alignedPtr = m_startPtr+m_currentOffset+adjustment;
+        m_currentOffset+=adjustment+size;
+        return alignedPtr;
+    }
+
+    void reset(){
+        m_currentOffset=0;
+    }
+
+    Marker getMarker() const {
+        return m_currentOffset;
+    }
+
+    // 只能往回退，传入比当前栈顶还高的标记说明嵌套顺序乱了
+    void freeToMarker(Marker marker){
+        if(marker>m_currentOffset){
+            throw std::logic_error("freeToMarker: marker is above the current top");
+        }
+        m_currentOffset=marker;
+    }
+
+    size_t used() const {
+        return m_currentOffset;
+    }
+
+    size_t capacity() const {
+        return m_totalSize;
+    }
+
+    void* getStart(){
+        return m_startPtr;
+    }
+
+    static size_t alignAdjustment(const void* ptr, size_t alignment){
+        size_t mask = alignment-1;
+        size_t misalignment = reinterpret_cast<size_t>(ptr) & mask;
+        return misalignment ? alignment - misalignment : 0;
+    }
+
+private:
+    char* m_startPtr;
+    size_t m_totalSize;
+    size_t m_currentOffset;
+};
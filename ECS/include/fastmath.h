@@ -0,0 +1,120 @@
+#pragma once
+
+// 模拟热循环用的快速数学函数：多项式近似，不查libm，不分支。
+// 平方根不在这里：sqrtf本身就是一条硬件指令，近似版本比不过它。
+// 每个函数有单个值的版本和一次算8个的版本，两者共用同一份模板实现：8路版本用GCC向量扩展，
+// 条件选择直接编成掩码混合指令。误差上界由 --bench-math 对照libm实测，写在各函数注释里
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+const int FAST_MATH_LANES = 8;
+
+namespace fast_math_detail {
+
+// 寄存器宽度取16字节，SSE2/NEON都原生支持；8路函数拆成两半各算一次
+const int VECTOR_WIDTH = 4;
+typedef float FloatLanes __attribute__((vector_size(VECTOR_WIDTH * sizeof(float))));
+typedef int32_t IntLanes __attribute__((vector_size(VECTOR_WIDTH * sizeof(int32_t))));
+typedef uint32_t UintLanes __attribute__((vector_size(VECTOR_WIDTH * sizeof(uint32_t))));
+
+// 单值和8路共用模板，只有位宽对应的整数类型和浮点转整数不同
+template<typename F> struct Lanes;
+template<> struct Lanes<float> {
+    using Uint = uint32_t;
+    static float truncate(float v) { return static_cast<float>(static_cast<int32_t>(v)); }
+};
+template<> struct Lanes<FloatLanes> {
+    using Uint = UintLanes;
+    static FloatLanes truncate(FloatLanes v) {
+        return __builtin_convertvector(__builtin_convertvector(v, IntLanes), FloatLanes);
+    }
+};
+
+constexpr float PI = 3.14159265358979f;
+constexpr float HALF_PI = 1.57079632679490f;
+constexpr float INV_TWO_PI = 0.159154943091895f;
+// 2pi拆成高低两段做范围约简(Cody-Waite)，高段乘整数k没有舍入误差
+constexpr float TWO_PI_HI = 6.28125f;
+constexpr float TWO_PI_LO = 0.00193530717958647f;
+
+template<typename F>
+F absolute(F x) {
+    using U = typename Lanes<F>::Uint;
+    return std::bit_cast<F>(std::bit_cast<U>(x) & 0x7fffffffu);
+}
+
+// [-pi/2, pi/2]上的sin，泰勒展开到x^11，截断误差 < 6e-8
+template<typename F>
+F sinPoly(F x) {
+    F x2 = x * x;
+    return x * (1.0f + x2 * (-1.0f / 6 + x2 * (1.0f / 120 + x2 * (-1.0f / 5040
+             + x2 * (1.0f / 362880 + x2 * (-1.0f / 39916800))))));
+}
+
+// [0,1]上的atan，最小最大多项式，截断误差 < 1e-5弧度
+template<typename F>
+F atanPoly(F z) {
+    F z2 = z * z;
+    return z * (0.99997726f + z2 * (-0.33262347f + z2 * (0.19354346f
+             + z2 * (-0.11643287f + z2 * (0.05265332f + z2 * -0.01172120f)))));
+}
+
+template<typename F>
+F atan2Approx(F y, F x) {
+    F ax = absolute(x);
+    F ay = absolute(y);
+    F hi = ax > ay ? ax : ay;
+    F lo = ax > ay ? ay : ax;
+    F one = hi * 0.0f + 1.0f;
+    F z = lo / (hi > 0.0f ? hi : one);
+    F r = atanPoly(z);
+    r = ay > ax ? HALF_PI - r : r;
+    r = x < 0.0f ? PI - r : r;
+    return y < 0.0f ? -r : r;
+}
+
+template<typename F>
+void sinCosApprox(F a, F& s, F& c) {
+    // 折回[-pi, pi]，四舍五入取整圈数
+    F t = a * INV_TWO_PI;
+    F half = absolute(t) * 0.0f + 0.5f;
+    F k = Lanes<F>::truncate(t + (t >= 0.0f ? half : -half));
+    F r = (a - k * TWO_PI_HI) - k * TWO_PI_LO;
+    // sin在[-pi/2, pi/2]外按 sin(pi - r) = sin(r) 折回；cos(r) = sin(pi/2 - |r|)
+    F sr = r > HALF_PI ? PI - r : (r < -HALF_PI ? -PI - r : r);
+    s = sinPoly(sr);
+    c = sinPoly(HALF_PI - absolute(r));
+}
+
+inline FloatLanes load(const float* p) {
+    FloatLanes v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline void store(float* p, FloatLanes v) { std::memcpy(p, &v, sizeof(v)); }
+
+} // namespace fast_math_detail
+
+// 绝对误差 < 2e-5弧度；(0,0)返回0
+inline float fastAtan2(float y, float x) { return fast_math_detail::atan2Approx(y, x); }
+
+// |a| < 1e5时绝对误差 < 2e-6
+inline void fastSinCos(float a, float& s, float& c) { fast_math_detail::sinCosApprox(a, s, c); }
+
+inline void fastAtan2x8(const float* y, const float* x, float* out) {
+    using namespace fast_math_detail;
+    for (int i = 0; i < FAST_MATH_LANES; i += VECTOR_WIDTH) store(out + i, atan2Approx(load(y + i), load(x + i)));
+}
+
+inline void fastSinCos8(const float* a, float* s, float* c) {
+    using namespace fast_math_detail;
+    for (int i = 0; i < FAST_MATH_LANES; i += VECTOR_WIDTH) {
+        FloatLanes vs, vc;
+        sinCosApprox(load(a + i), vs, vc);
+        store(s + i, vs);
+        store(c + i, vc);
+    }
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+// Q16.16定点数和查表三角函数，给锁步回放用：只用整数运算，不同编译器/CPU上逐位一致。
+// 三角表在编译期用只含加减乘除的级数生成，不依赖libm
+
+#include <array>
+#include <cstdint>
+
+struct Fixed {
+    static constexpr int FRACTION_BITS = 16;
+    static constexpr int32_t ONE = 1 << FRACTION_BITS;
+
+    int32_t raw;
+
+    constexpr Fixed() : raw(0) {}
+
+    static constexpr Fixed fromRaw(int32_t r) {
+        Fixed f;
+        f.raw = r;
+        return f;
+    }
+    static constexpr Fixed fromInt(int v) { return fromRaw(v * ONE); }
+    // 四舍五入到最近的1/65536
+    static constexpr Fixed fromFloat(float v) {
+        float scaled = v * static_cast<float>(ONE);
+        return fromRaw(static_cast<int32_t>(scaled >= 0 ? scaled + 0.5f : scaled - 0.5f));
+    }
+    constexpr float toFloat() const { return static_cast<float>(raw) / static_cast<float>(ONE); }
+
+    constexpr Fixed operator-() const { return fromRaw(-raw); }
+    constexpr Fixed operator+(Fixed o) const { return fromRaw(raw + o.raw); }
+    constexpr Fixed operator-(Fixed o) const { return fromRaw(raw - o.raw); }
+    constexpr Fixed operator*(Fixed o) const {
+        return fromRaw(static_cast<int32_t>((static_cast<int64_t>(raw) * o.raw) >> FRACTION_BITS));
+    }
+    constexpr Fixed operator/(Fixed o) const {
+        return fromRaw(static_cast<int32_t>((static_cast<int64_t>(raw) << FRACTION_BITS) / o.raw));
+    }
+    constexpr Fixed& operator+=(Fixed o) { raw += o.raw; return *this; }
+    constexpr Fixed& operator-=(Fixed o) { raw -= o.raw; return *this; }
+    constexpr Fixed& operator*=(Fixed o) { return *this = *this * o; }
+
+    constexpr bool operator==(Fixed o) const { return raw == o.raw; }
+    constexpr bool operator!=(Fixed o) const { return raw != o.raw; }
+    constexpr bool operator<(Fixed o) const { return raw < o.raw; }
+    constexpr bool operator<=(Fixed o) const { return raw <= o.raw; }
+    constexpr bool operator>(Fixed o) const { return raw > o.raw; }
+    constexpr bool operator>=(Fixed o) const { return raw >= o.raw; }
+};
+
+// 距离平方用Q32.32的int64保存，战场1000x1000也不会溢出
+constexpr int64_t fixedDistSq(Fixed dx, Fixed dy) {
+    return static_cast<int64_t>(dx.raw) * dx.raw + static_cast<int64_t>(dy.raw) * dy.raw;
+}
+
+namespace fixed_detail {
+
+constexpr double PI = 3.14159265358979323846;
+constexpr int SIN_TABLE_SIZE = 4096;            // 一整圈
+constexpr int ATAN_TABLE_SIZE = 1024;           // 比值[0,1]
+
+constexpr int32_t roundToRaw(double v) {
+    return static_cast<int32_t>(v >= 0 ? v * Fixed::ONE + 0.5 : v * Fixed::ONE - 0.5);
+}
+
+// x在[0, pi/2]内，泰勒级数收敛很快
+constexpr double sinSeries(double x) {
+    double term = x;
+    double sum = x;
+    for (int n = 1; n < 16; ++n) {
+        term *= -x * x / ((2 * n) * (2 * n + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+// |x| <= tan(pi/8)时直接展开
+constexpr double atanSeries(double x) {
+    double term = x;
+    double sum = x;
+    for (int n = 1; n < 30; ++n) {
+        term *= -x * x;
+        sum += term / (2 * n + 1);
+    }
+    return sum;
+}
+
+constexpr double atanUnit(double r) {
+    // r > tan(pi/8)时用 atan(r) = pi/4 + atan((r-1)/(r+1)) 把参数缩小
+    return r <= 0.41421356237309503 ? atanSeries(r) : PI / 4 + atanSeries((r - 1) / (r + 1));
+}
+
+constexpr std::array<int32_t, SIN_TABLE_SIZE> makeSinTable() {
+    std::array<int32_t, SIN_TABLE_SIZE> table{};
+    constexpr int QUARTER = SIN_TABLE_SIZE / 4;
+    for (int i = 0; i <= QUARTER; ++i) {
+        int32_t v = roundToRaw(sinSeries(2 * PI * i / SIN_TABLE_SIZE));
+        table[i] = v;                                       // [0, pi/2]
+        if (i < QUARTER) table[2 * QUARTER - i] = v;        // (pi/2, pi]
+        if (i > 0) table[2 * QUARTER + i] = -v;             // (pi, 3pi/2]
+        if (i > 0 && i < QUARTER) table[4 * QUARTER - i] = -v;
+    }
+    return table;
+}
+
+constexpr std::array<int32_t, ATAN_TABLE_SIZE + 1> makeAtanTable() {
+    std::array<int32_t, ATAN_TABLE_SIZE + 1> table{};
+    for (int i = 0; i <= ATAN_TABLE_SIZE; ++i) table[i] = roundToRaw(atanUnit(static_cast<double>(i) / ATAN_TABLE_SIZE));
+    return table;
+}
+
+inline constexpr std::array<int32_t, SIN_TABLE_SIZE> SIN_TABLE = makeSinTable();
+inline constexpr std::array<int32_t, ATAN_TABLE_SIZE + 1> ATAN_TABLE = makeAtanTable();
+
+constexpr int32_t PI_RAW = roundToRaw(PI);
+constexpr int32_t HALF_PI_RAW = roundToRaw(PI / 2);
+constexpr int32_t TWO_PI_RAW = roundToRaw(2 * PI);
+
+} // namespace fixed_detail
+
+// 弧度转成最近的表下标，先把角度折回[0, 2pi)
+constexpr int fixedAngleIndex(Fixed angle) {
+    int32_t a = angle.raw % fixed_detail::TWO_PI_RAW;
+    if (a < 0) a += fixed_detail::TWO_PI_RAW;
+    int64_t scaled = static_cast<int64_t>(a) * fixed_detail::SIN_TABLE_SIZE + fixed_detail::TWO_PI_RAW / 2;
+    return static_cast<int>(scaled / fixed_detail::TWO_PI_RAW) & (fixed_detail::SIN_TABLE_SIZE - 1);
+}
+
+constexpr Fixed fixedSin(Fixed angle) {
+    return Fixed::fromRaw(fixed_detail::SIN_TABLE[fixedAngleIndex(angle)]);
+}
+
+constexpr Fixed fixedCos(Fixed angle) {
+    int index = (fixedAngleIndex(angle) + fixed_detail::SIN_TABLE_SIZE / 4) & (fixed_detail::SIN_TABLE_SIZE - 1);
+    return Fixed::fromRaw(fixed_detail::SIN_TABLE[index]);
+}
+
+// 按八分圆折到比值[0,1]上查表并线性插值，结果在[-pi, pi]
+constexpr Fixed fixedAtan2(Fixed y, Fixed x) {
+    if (x.raw == 0 && y.raw == 0) return Fixed();
+    int64_t ax = x.raw < 0 ? -static_cast<int64_t>(x.raw) : x.raw;
+    int64_t ay = y.raw < 0 ? -static_cast<int64_t>(y.raw) : y.raw;
+    bool steep = ay > ax;
+    int64_t num = steep ? ax : ay;
+    int64_t den = steep ? ay : ax;
+
+    // 比值放大到 ATAN_TABLE_SIZE * 65536，整数部分查表，余数插值
+    int64_t ratio = (num * fixed_detail::ATAN_TABLE_SIZE << Fixed::FRACTION_BITS) / den;
+    int64_t index = ratio >> Fixed::FRACTION_BITS;
+    int64_t frac = ratio & (Fixed::ONE - 1);
+    int64_t lo = fixed_detail::ATAN_TABLE[index];
+    int64_t hi = fixed_detail::ATAN_TABLE[index < fixed_detail::ATAN_TABLE_SIZE ? index + 1 : index];
+    int32_t angle = static_cast<int32_t>(lo + (((hi - lo) * frac) >> Fixed::FRACTION_BITS));
+
+    if (steep) angle = fixed_detail::HALF_PI_RAW - angle;
+    if (x.raw < 0) angle = fixed_detail::PI_RAW - angle;
+    if (y.raw < 0) angle = -angle;
+    return Fixed::fromRaw(angle);
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+// 世界状态的共享内存导出格式，模拟进程写、分析/回放进程只读映射。
+// 段开头是ShmWorldHeader，后面是按64字节对齐的各列数组。
+// 头里的sequence是seqlock版本号：奇数表示写者正在写，读者读前读后各看一次，不一致就重读
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const uint32_t SHM_WORLD_MAGIC = 0x45435357;   // "WSCE"
+const uint32_t SHM_WORLD_VERSION = 1;
+const char* const SHM_WORLD_DEFAULT_NAME = "/ecs_world";
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "seqlock counter must be lock-free to live in shared memory");
+
+struct ShmWorldHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;          // 每列的最大实体数
+    uint32_t reserved;
+    uint64_t entityOffset;      // 各列相对段开头的字节偏移
+    uint64_t xOffset;
+    uint64_t yOffset;
+    uint64_t healthOffset;
+    uint64_t stateOffset;       // UnitState，uint8
+    uint64_t teamOffset;        // Team::id，uint8
+    uint64_t totalSize;
+
+    // 写者每次发布改动的部分，单独放一条缓存行
+    alignas(64) std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> frame;
+    std::atomic<float> elapsed;
+    std::atomic<uint32_t> count;
+};
+
+// 按容量填好头里的布局字段(各列偏移、总大小)，写者和读者用同一份布局
+inline void shmWorldLayout(ShmWorldHeader& h, uint32_t capacity) {
+    auto column = [](uint64_t& cursor, uint64_t bytes) {
+        uint64_t offset = (cursor + 63) / 64 * 64;
+        cursor = offset + bytes;
+        return offset;
+    };
+    uint64_t cursor = sizeof(ShmWorldHeader);
+    h.magic = SHM_WORLD_MAGIC;
+    h.version = SHM_WORLD_VERSION;
+    h.capacity = capacity;
+    h.reserved = 0;
+    h.entityOffset = column(cursor, capacity * sizeof(uint32_t));
+    h.xOffset = column(cursor, capacity * sizeof(float));
+    h.yOffset = column(cursor, capacity * sizeof(float));
+    h.healthOffset = column(cursor, capacity * sizeof(int32_t));
+    h.stateOffset = column(cursor, capacity * sizeof(uint8_t));
+    h.teamOffset = column(cursor, capacity * sizeof(uint8_t));
+    h.totalSize = cursor;
+}
+
+// 一次采样看到的世界，指针直接指向共享内存，不做拷贝
+struct ShmWorldView {
+    uint64_t frame;
+    float elapsed;
+    uint32_t count;
+    const uint32_t* entity;
+    const float* x;
+    const float* y;
+    const int32_t* health;
+    const uint8_t* state;
+    const uint8_t* team;
+};
+
+class ShmWorldReader {
+private:
+    int fd;
+    const char* base;
+    size_t mappedSize;
+
+    const ShmWorldHeader* header() const { return reinterpret_cast<const ShmWorldHeader*>(base); }
+
+public:
+    ShmWorldReader() : fd(-1), base(nullptr), mappedSize(0) {}
+    ~ShmWorldReader() { close(); }
+
+    ShmWorldReader(const ShmWorldReader&) = delete;
+    ShmWorldReader& operator=(const ShmWorldReader&) = delete;
+
+    // 只读映射已有的段，段不存在或格式不对返回false
+    bool open(const char* name = SHM_WORLD_DEFAULT_NAME) {
+        close();
+        fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ShmWorldHeader)) {
+            close();
+            return false;
+        }
+        mappedSize = static_cast<size_t>(st.st_size);
+        void* p = mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            close();
+            return false;
+        }
+        base = static_cast<const char*>(p);
+
+        const ShmWorldHeader* h = header();
+        if (h->magic != SHM_WORLD_MAGIC || h->version != SHM_WORLD_VERSION || h->totalSize > mappedSize) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (base) munmap(const_cast<char*>(base), mappedSize);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        base = nullptr;
+        mappedSize = 0;
+    }
+
+    bool isOpen() const { return base != nullptr; }
+    uint32_t capacity() const { return header()->capacity; }
+
+    // 在一致的一帧上调用fn(const ShmWorldView&)。fn直接读共享内存，写者中途发布时
+    // 这一轮作废重来，所以fn每次调用都要从头算、只把结果写进自己的局部状态。
+    // 重试maxAttempts次仍读不到一致的一帧返回false
+    template<typename Fn>
+    bool sample(Fn fn, int maxAttempts = 16) const {
+        const ShmWorldHeader* h = header();
+        for (int attempt = 0; attempt < maxAttempts; ++attempt) {
+            uint64_t before = h->sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                sched_yield();
+                continue;
+            }
+
+            ShmWorldView view;
+            view.frame = h->frame.load(std::memory_order_relaxed);
+            view.elapsed = h->elapsed.load(std::memory_order_relaxed);
+            view.count = h->count.load(std::memory_order_relaxed);
+            if (view.count > h->capacity) continue;
+            view.entity = reinterpret_cast<const uint32_t*>(base + h->entityOffset);
+            view.x = reinterpret_cast<const float*>(base + h->xOffset);
+            view.y = reinterpret_cast<const float*>(base + h->yOffset);
+            view.health = reinterpret_cast<const int32_t*>(base + h->healthOffset);
+            view.state = reinterpret_cast<const uint8_t*>(base + h->stateOffset);
+            view.team = reinterpret_cast<const uint8_t*>(base + h->teamOffset);
+            fn(view);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (h->sequence.load(std::memory_order_relaxed) == before) return true;
+            sched_yield();
+        }
+        return false;
+    }
+};
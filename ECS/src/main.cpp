@@ -1,4 +1,5 @@
 #include <iostream>
+#include <cassert>
 #include <vector>
 #include <unordered_map>
 #include <memory>
@@ -6,9 +7,94 @@
 #include <cstdlib>
 #include <ctime>
 #include <cmath>
+#include <cstdint>
+#include <chrono>
+#include <coroutine>
+#include <queue>
+#include <exception>
+#include <array>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <tuple>
+#include <typeinfo>
+#include <type_traits>
+#include <functional>
+#include <cstring>
+#include <cstddef>
+#include <limits>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <new>
+#include <stdexcept>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "shm_world.h"
+#include "fastmath.h"
+#include "DoubleBufferAllocator.h"
+#include "StackAllocator.h"
+#ifdef ECS_FIXED_POINT
+#include "fixed.h"
+#endif
 
 const size_t MAX_ENTITIES = 100000;
 const size_t COMPONENT_POOL_SIZE = 1024 * 1024;
+const float WORLD_SIZE = 1000.0f;
+const float GRID_CELL_SIZE = 25.0f;
+const size_t DAMAGE_HISTOGRAM_BUCKETS = 8;
+const int DAMAGE_HISTOGRAM_WIDTH = 5;
+const size_t MAX_TEAMS = 8;
+const float SHARD_GHOST_WIDTH = 2 * GRID_CELL_SIZE;
+const float REGION_SIZE = 125.0f;
+const int REGION_PAGING_PERIOD = 16;
+const float DORMANT_AGGRO_RADIUS = GRID_CELL_SIZE;
+const uint32_t DORMANT_WAKE_STRIDE = 8;
+const size_t FRAME_ARENA_SIZE = 8 * 1024 * 1024;
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+const char* const TELEMETRY_DEFAULT_PATH = "/tmp/ecs_telemetry.sock";
+
+// 模拟用的坐标类型。ECS_FIXED_POINT打开时位置、速度、朝向都是Q16.16定点数，
+// 移动和射程判定只走整数运算和查表三角，不同机器上跑出来逐位一致，可以做锁步；
+// 网格、LOD、快照这些只读位置的地方统一经过toFloat
+#ifdef ECS_FIXED_POINT
+using Coord = Fixed;
+using CoordDistSq = int64_t;
+inline Coord toCoord(float v) { return Fixed::fromFloat(v); }
+inline float toFloat(Coord v) { return v.toFloat(); }
+inline CoordDistSq distSq(Coord dx, Coord dy) { return fixedDistSq(dx, dy); }
+inline void coordSinCos(Coord a, Coord& s, Coord& c) { s = fixedSin(a); c = fixedCos(a); }
+inline Coord coordAtan2(Coord y, Coord x) { return fixedAtan2(y, x); }
+// 定点模式的批量版本逐个查表，保持和单个调用逐位一致
+inline void coordSinCos8(const Coord* a, Coord* s, Coord* c) {
+    for (int i = 0; i < FAST_MATH_LANES; ++i) coordSinCos(a[i], s[i], c[i]);
+}
+inline void coordAtan2x8(const Coord* y, const Coord* x, Coord* out) {
+    for (int i = 0; i < FAST_MATH_LANES; ++i) out[i] = fixedAtan2(y[i], x[i]);
+}
+#else
+using Coord = float;
+using CoordDistSq = float;
+inline Coord toCoord(float v) { return v; }
+inline float toFloat(Coord v) { return v; }
+inline CoordDistSq distSq(Coord dx, Coord dy) { return dx*dx + dy*dy; }
+// 浮点模式走fastmath的多项式近似，单个和8路版本结果一致
+inline void coordSinCos(Coord a, Coord& s, Coord& c) { fastSinCos(a, s, c); }
+inline Coord coordAtan2(Coord y, Coord x) { return fastAtan2(y, x); }
+inline void coordSinCos8(const Coord* a, Coord* s, Coord* c) { fastSinCos8(a, s, c); }
+inline void coordAtan2x8(const Coord* y, const Coord* x, Coord* out) { fastAtan2x8(y, x, out); }
+#endif
 
 enum class UnitState {
     IDLE,
@@ -23,54 +109,271 @@ enum class DamageType {
     TRUE_DAMAGE
 };
 
+// 组件池通知的事件类型，帧内攒成批次，到同步点统一派发
+enum class ComponentEvent {
+    ADDED,
+    REMOVED,
+    CHANGED
+};
+
+using ComponentObserver = std::function<void(const std::vector<uint32_t>&)>;
+
 class IComponentPool{
 public:
     virtual ~IComponentPool() = default;
     virtual void remove(size_t entity) = 0;     
+    virtual void dispatchEvents() = 0;
+    virtual void beginFrame() = 0;
+};
+
+// 组件列实际拿到的页类型
+enum class PageBacking {
+    HUGETLB,            // 预留的2MB大页(MAP_HUGETLB)
+    TRANSPARENT_HUGE,   // 普通映射加MADV_HUGEPAGE，由内核透明大页合并
+    REGULAR,
+    COUNT
+};
+
+const char* const PAGE_BACKING_NAMES[] = {"hugetlb", "thp", "regular"};
+
+// 一段组件列内存，释放时要用原来的映射长度
+struct ColumnMemory {
+    void* base;
+    size_t length;
+    PageBacking backing;
+};
+
+// 组件列的分配策略：先要大页，大页没有预留就退到透明大页，再不行用普通页，都不影响正确性。
+// NUMA节点不在这里指定：映射出来的页还没分配，按内核默认的首次访问策略落在第一次写它的线程所在节点。
+// 批量模式每个工作线程自己建世界、自己生成单位，列的页就落在这个工作线程的节点上。
+// 映射出来的内存全是0，池子不用再逐个清标记，也就不会在分配线程上提前把页碰掉
+class ColumnAllocator {
+public:
+    struct Policy {
+        bool hugePages;
+    };
+
+private:
+    static Policy& policy() {
+        static Policy current{true};
+        return current;
+    }
+
+    static std::atomic<size_t>* backingCounters() {
+        static std::atomic<size_t> counters[static_cast<size_t>(PageBacking::COUNT)];
+        return counters;
+    }
+
+    // 多映射一个大页再裁掉首尾，拿到2MB对齐的区间，透明大页才能整页合并
+    static void* mapAligned(size_t length) {
+        size_t padded = length + HUGE_PAGE_SIZE;
+        void* raw = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) return nullptr;
+        uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+        uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        if (aligned > start) munmap(raw, aligned - start);
+        size_t tail = (start + padded) - (aligned + length);
+        if (tail > 0) munmap(reinterpret_cast<void*>(aligned + length), tail);
+        return reinterpret_cast<void*>(aligned);
+    }
+
+public:
+    static void setPolicy(const Policy& p) { policy() = p; }
+
+    // 分配失败抛std::bad_alloc，和malloc版本的池子一致
+    static ColumnMemory allocate(size_t bytes) {
+        const Policy p = policy();
+        const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        ColumnMemory memory{nullptr, 0, PageBacking::REGULAR};
+
+        // 不到半个大页的列凑整浪费太多，直接用普通页
+        bool huge = p.hugePages && bytes >= HUGE_PAGE_SIZE / 2;
+        if (huge) {
+            memory.length = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+            void* mapped = mmap(nullptr, memory.length, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (mapped != MAP_FAILED) {
+                memory.base = mapped;
+                memory.backing = PageBacking::HUGETLB;
+            } else if ((mapped = mapAligned(memory.length)) != nullptr) {
+                memory.base = mapped;
+                memory.backing = madvise(mapped, memory.length, MADV_HUGEPAGE) == 0
+                               ? PageBacking::TRANSPARENT_HUGE : PageBacking::REGULAR;
+            }
+        }
+        if (!memory.base) {
+            memory.length = (bytes + pageSize - 1) / pageSize * pageSize;
+            void* mapped = mmap(nullptr, memory.length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapped == MAP_FAILED) throw std::bad_alloc();
+            memory.base = mapped;
+            memory.backing = PageBacking::REGULAR;
+        }
+
+        backingCounters()[static_cast<size_t>(memory.backing)]++;
+        return memory;
+    }
+
+    static void release(ColumnMemory& memory) {
+        if (memory.base) munmap(memory.base, memory.length);
+        memory.base = nullptr;
+        memory.length = 0;
+    }
+
+    // 进程里累计分配过的列按页类型的个数
+    static size_t columns(PageBacking backing) { return backingCounters()[static_cast<size_t>(backing)].load(); }
 };
 
 template<typename T>
-class ComponentPool : public IComponentPool{
+class ComponentPool final : public IComponentPool{
 private:
     struct Block {
         T data;
         bool active;
     };
+    ColumnMemory blockMemory;
     Block* blocks;
     size_t capacity;
     size_t count;
+    // 没有观察者的事件不记录，不订阅就没有额外开销
+    std::vector<ComponentObserver> observers[3];
+    std::vector<uint32_t> pending[3];
+    std::vector<uint32_t> batch;
+    // 已经排进待派发CHANGED批次的槽位，同一批里每个实体只出现一次；有CHANGED观察者才分配
+    std::vector<uint8_t> changePending;
+    // 可选的变更追踪：每个槽位最后一次通过write()写入的帧号，加上本帧写过的实体列表
+    ColumnMemory changedMemory;
+    uint32_t* changedFrame;
+    uint32_t frame;
+    std::vector<uint32_t> dirty;
+
+    void record(ComponentEvent event, size_t entity) {
+        size_t e = static_cast<size_t>(event);
+        if (observers[e].empty()) return;
+        if (event == ComponentEvent::CHANGED) {
+            if (changePending[entity]) return;
+            changePending[entity] = 1;
+        }
+        pending[e].push_back(static_cast<uint32_t>(entity));
+    }
 public:
+    ComponentPool(const ComponentPool&) = delete;
+    ComponentPool& operator=(const ComponentPool&) = delete;
     ComponentPool() {
         capacity = MAX_ENTITIES;
-        blocks = static_cast<Block*>(malloc(capacity * sizeof(Block)));
-        for( size_t i =0;i<capacity;++i){
-            blocks[i].active = false;
-        }
+        // 新映射的内存全是0，active标记天然是false
+        blockMemory = ColumnAllocator::allocate(capacity * sizeof(Block));
+        blocks = static_cast<Block*>(blockMemory.base);
         count =0;
+        changedMemory = ColumnMemory{nullptr, 0, PageBacking::REGULAR};
+        changedFrame = nullptr;
+        frame = 1;
     }
-    ~ComponentPool() {free(blocks)};
+    ~ComponentPool() {ColumnAllocator::release(blockMemory); ColumnAllocator::release(changedMemory);}
     T* assign(size_t entity){
         if(entity>=capacity) return nullptr;
         if(blocks[entity].active) return nullptr;
         blocks[entity].active = true;
         blocks[entity].data=T();
         count++;
+        record(ComponentEvent::ADDED, entity);
         return &blocks[entity].data;
     }
     void remove(size_t entity) override {
         if(entity>=capacity || !blocks[entity].active) return;
         blocks[entity].active = false;
         count--;
+        record(ComponentEvent::REMOVED, entity);
+    }
+    void notifyChanged(size_t entity){
+        if(entity<capacity && blocks[entity].active) record(ComponentEvent::CHANGED, entity);
+    }
+    void observe(ComponentEvent event, ComponentObserver observer){
+        if(event == ComponentEvent::CHANGED && changePending.empty()) changePending.assign(capacity, 0);
+        observers[static_cast<size_t>(event)].push_back(std::move(observer));
+    }
+    // 按 删除 -> 添加 -> 修改 的顺序派发，同一帧里槽位先删后复用也能得到正确结果。
+    // 观察者在回调里产生的新事件进入下一批
+    void dispatchEvents() override {
+        for (size_t e = 0; e < 3; ++e) {
+            if (pending[e].empty()) continue;
+            batch.clear();
+            batch.swap(pending[e]);
+            // 先清掉标记，观察者回调里再写的实体进下一批
+            if (e == static_cast<size_t>(ComponentEvent::CHANGED)) {
+                for (uint32_t entity : batch) changePending[entity] = 0;
+            }
+            for (ComponentObserver& observer : observers[e]) {
+                observer(batch);
+            }
+        }
     }
     T* get(size_t entity){
         return (entity<capacity&&blocks[entity].active) ? &blocks[entity].data : nullptr;
     }
     size_t size() const {return count;}
+
+    void enableChangeTracking(){
+        if(changedFrame) return;
+        changedMemory = ColumnAllocator::allocate(capacity * sizeof(uint32_t));
+        changedFrame = static_cast<uint32_t*>(changedMemory.base);
+    }
+    bool tracksChanges() const {return changedFrame != nullptr;}
+    // 写访问：打上本帧的标记，同时通知CHANGED观察者(同一批里重复写只通知一次)
+    T* write(size_t entity){
+        T* data = get(entity);
+        if(!data) return nullptr;
+        if(changedFrame && changedFrame[entity] != frame){
+            changedFrame[entity] = frame;
+            dirty.push_back(static_cast<uint32_t>(entity));
+        }
+        record(ComponentEvent::CHANGED, entity);
+        return data;
+    }
+    bool changed(size_t entity) const {
+        return changedFrame && entity<capacity && changedFrame[entity] == frame;
+    }
+    // 本帧写过的实体（每个只出现一次），开销与变化量成正比
+    const std::vector<uint32_t>& changedEntities() const {return dirty;}
+    void beginFrame() override {
+        if(!changedFrame) return;
+        ++frame;
+        dirty.clear();
+    }
+};
+
+// 遍历本帧改过T的实体，要求同时拥有With...组件：fn(entity, T&, With&...)
+template<typename T, typename... With, typename Store, typename Fn>
+void forEachChanged(Store& store, Fn&& fn){
+    ComponentPool<T>* pool = store.template getPool<T>();
+    if(!pool) return;
+    for(uint32_t e : pool->changedEntities()){
+        T* data = pool->get(e);
+        if(!data) continue;
+        [[maybe_unused]] std::tuple<With*...> others(store.template getPool<With>()->get(e)...);
+        bool complete = ((std::get<With*>(others) != nullptr) && ...);
+        if(complete) fn(static_cast<size_t>(e), *data, *std::get<With*>(others)...);
+    }
+}
+
+// 实体句柄：槽位下标 + 代数各32位。槽位回收时代数加一，指向旧单位的句柄自然失效
+struct Entity {
+    static constexpr uint32_t INVALID_INDEX = 0xFFFFFFFF;
+
+    uint32_t index;
+    uint32_t generation;
+
+    Entity() : index(INVALID_INDEX), generation(0) {}
+    Entity(uint32_t i, uint32_t g) : index(i), generation(g) {}
+
+    bool valid() const { return index != INVALID_INDEX; }
+    uint64_t id() const { return (static_cast<uint64_t>(generation) << 32) | index; }
+    bool operator==(const Entity& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const Entity& other) const { return !(*this == other); }
 };
 
 struct Transform {
-    float x, y, z;
-    Transform() : x(0), y(0), z(0) {}
+    Coord x, y, z;
+    Transform() : x(), y(), z() {}
 };
 
 struct CombatStats {
@@ -78,7 +381,7 @@ struct CombatStats {
     int maxHealth;
     int attack;
     int defense;
-    float attackRange;
+    Coord attackRange;
     float attackSpeed;
     float attackCooldown;
     DamageType damageType;
@@ -86,19 +389,18 @@ struct CombatStats {
 
     CombatStats()
         : health(100), maxHealth(100), attack(10), defense(5),
-          attackRange(5.0f), attackSpeed(1.0f), attackCooldown(0),
+          attackRange(toCoord(5.0f)), attackSpeed(1.0f), attackCooldown(0),
           damageType(DamageType::PHYSICAL), state(UnitState::IDLE) {}
 };
 
 struct Movement {
-    float velocity;
-    float direction;
+    Coord velocity;
+    Coord direction;
     float moveRange;
-    size_t targetEntity;
+    Entity targetEntity;
 
     Movement()
-        : velocity(0), direction(0), moveRange(20.0f),
-          targetEntity(-1) {}
+        : velocity(), direction(), moveRange(20.0f) {}
 };
 
 struct StatusEffects {
@@ -112,6 +414,26 @@ struct StatusEffects {
           effectDuration(0) {}
 };
 
+// 标记由协程行为驱动的单位，AISystem和CombatSystem的攻击逻辑会跳过它们
+struct ScriptedBehavior {
+    uint32_t attacks;   // 协程发起的攻击次数
+    ScriptedBehavior() : attacks(0) {}
+};
+
+// 所属队伍，出生时确定，之后不再变化
+struct Team {
+    uint8_t id;
+    Team() : id(0) {}
+};
+
+// 相邻分片单位在本地的影子：只用来被找到、被攻击，不参与本地的AI/移动/结算，每帧由邻居刷新
+struct Ghost {
+    uint8_t side;           // 0左邻居 1右邻居
+    Entity remote;          // 在所属分片里的句柄
+    uint32_t seenFrame;
+    Ghost() : side(0), seenFrame(0) {}
+};
+
 class ComponentManager {
 private:
     std::unordered_map<size_t,IComponentPool*> componentPools;
@@ -147,6 +469,30 @@ public:
             pair.second->remove(entity);
         }
     }
+    template<typename T>
+    void markChanged(size_t entity){
+        if(auto pool = getPool<T>()){
+            pool->notifyChanged(entity);
+        }
+    }
+    template<typename T>
+    void observe(ComponentEvent event, ComponentObserver observer){
+        if(auto pool = getPool<T>()){
+            pool->observe(event, std::move(observer));
+        }
+    }
+    // 同步点：把各组件池本帧攒下的通知批量派发给观察者
+    void dispatchEvents(){
+        for(auto& pair : componentPools){
+            pair.second->dispatchEvents();
+        }
+    }
+    // 帧开始时清空各池的本帧变更标记
+    void beginFrame(){
+        for(auto& pair : componentPools){
+            pair.second->beginFrame();
+        }
+    }
     ~ComponentManager() {
         for(auto& pair : componentPools){
             delete pair.second;
@@ -154,372 +500,3867 @@ public:
     }
 };
 
+// 编译期确定组件集合的世界：组件池放在tuple里，getPool<T>在编译期解析，
+// removeAllComponents用折叠表达式展开，热路径上没有哈希查找和虚调用
+template<typename... Components>
+class World {
+private:
+    std::tuple<ComponentPool<Components>...> pools;
+
+    template<typename T>
+    static constexpr bool contains() { return (std::is_same_v<T, Components> || ...); }
+
+public:
+    // 组件集合在模板参数里已经确定，这里只做编译期检查，保持和ComponentManager一样的接口
+    template<typename T>
+    void registerComponent(){
+        static_assert(contains<T>(), "component is not part of this World");
+    }
+    template<typename T>
+    ComponentPool<T>* getPool(){
+        static_assert(contains<T>(), "component is not part of this World");
+        return &std::get<ComponentPool<T>>(pools);
+    }
+    template<typename T>
+    T* assignComponent(size_t entity){
+        return getPool<T>()->assign(entity);
+    }
+    template<typename T>
+    void removeComponent(size_t entity){
+        getPool<T>()->remove(entity);
+    }
+    void removeAllComponents(size_t entity){
+        (std::get<ComponentPool<Components>>(pools).remove(entity), ...);
+    }
+    template<typename T>
+    void markChanged(size_t entity){
+        getPool<T>()->notifyChanged(entity);
+    }
+    template<typename T>
+    void observe(ComponentEvent event, ComponentObserver observer){
+        getPool<T>()->observe(event, std::move(observer));
+    }
+    void dispatchEvents(){
+        (std::get<ComponentPool<Components>>(pools).dispatchEvents(), ...);
+    }
+    void beginFrame(){
+        (std::get<ComponentPool<Components>>(pools).beginFrame(), ...);
+    }
+};
+
+// 默认使用编译期World；定义ECS_DYNAMIC_COMPONENTS时退回运行时注册的ComponentManager
+#ifdef ECS_DYNAMIC_COMPONENTS
+using ComponentStore = ComponentManager;
+#else
+using ComponentStore = World<Transform, CombatStats, Movement, StatusEffects, ScriptedBehavior, Team, Ghost>;
+#endif
+
 class EntityManager {
 private:
-    std::vector<size_t> available;
+    std::vector<uint32_t> available;
+    std::vector<uint32_t> generations;   // 每个槽位当前的代数，紧凑存放。创建和销毁各加一，奇数表示槽位在用
     size_t livingCount;
+    size_t highWater;
 
 public:
-    EntityManager() : livingCount(0) {
+    EntityManager() : generations(MAX_ENTITIES, 0), livingCount(0), highWater(0) {
         available.reserve(MAX_ENTITIES);
         for (size_t i = MAX_ENTITIES; i > 0; --i) {
-            available.push_back(i - 1);
+            available.push_back(static_cast<uint32_t>(i - 1));
         }
     }
 
-    size_t create() {
-        if (available.empty()) return -1;
-        size_t id = available.back();
+    Entity create() {
+        if (available.empty()) return Entity();
+        uint32_t index = available.back();
         available.pop_back();
         livingCount++;
-        return id;
+        if (index >= highWater) highWater = index + 1;
+        return Entity(index, ++generations[index]);
     }
 
-    void destroy(size_t entity) {
-        available.push_back(entity);
+    void destroy(Entity entity) {
+        if (!isAlive(entity)) return;
+        generations[entity.index]++;
+        available.push_back(entity.index);
         livingCount--;
     }
 
+    // 句柄是否仍指向活着的实体：一次读取一次比较，不碰组件内存
+    bool isAlive(Entity entity) const {
+        return (entity.generation & 1) && entity.index < MAX_ENTITIES &&
+               generations[entity.index] == entity.generation;
+    }
+
+    // 由槽位下标得到当前句柄，空闲槽位得到的句柄isAlive为false
+    Entity handle(size_t index) const {
+        return Entity(static_cast<uint32_t>(index), generations[index]);
+    }
+
     size_t count() const { return livingCount; }
+
+    // 分配过的最大ID+1，系统遍历到这里为止即可
+    size_t extent() const { return highWater; }
 };
 
-class CombatSystem {
+// 每个世界独立的随机数发生器(xorshift64*)，同一种子的战斗可以复现，多线程跑多个世界互不干扰
+class Random {
 private:
-    ComponentManager* components;
-    EntityManager* entities;
-    
-    int calculateDamage(int attack, int defense, DamageType type) {
-        switch(type) {
-            case DamageType::PHYSICAL:
-                return std::max(1, attack - defense/2);
-            case DamageType::MAGIC:
-                return attack + rand() % (attack/2 + 1);
-            case DamageType::TRUE_DAMAGE:
-                return attack;
-            default:
-                return attack;
-        }
-    }
-
-    bool inAttackRange(size_t attacker, size_t target) {
-        auto transformPool = components->getPool<Transform>();
-        Transform* t1 = transformPool->get(attacker);
-        Transform* t2 = transformPool->get(target);
-        auto combatPool = components->getPool<CombatStats>();
-        CombatStats* stats = combatPool->get(attacker);
+    uint64_t state;
 
-        if (!t1 || !t2 || !stats) return false;
+public:
+    explicit Random(uint64_t seed = 1) { reseed(seed); }
 
-        float dx = t1->x - t2->x;
-        float dy = t1->y - t2->y;
-        float distance = std::sqrt(dx*dx + dy*dy);
+    void reseed(uint64_t seed) {
+        state = seed ? seed : 0x9E3779B97F4A7C15ull;
+    }
 
-        return distance <= stats->attackRange;
+    uint32_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return static_cast<uint32_t>((state * 0x2545F4914F6CDD1Dull) >> 32);
     }
 
-public:
-    CombatSystem(ComponentManager* cm, EntityManager* em)
-        : components(cm), entities(em) {}
+    // [0, n)
+    uint32_t range(uint32_t n) { return n ? next() % n : 0; }
 
-    void update(float deltaTime) {
-        auto combatPool = components->getPool<CombatStats>();
-        auto transformPool = components->getPool<Transform>();
-        auto movementPool = components->getPool<Movement>();
-        auto statusPool = components->getPool<StatusEffects>();
+    // [0, 1)
+    float uniform() { return (next() >> 8) * (1.0f / 16777216.0f); }
+};
 
-        for (size_t i = 0; i < MAX_ENTITIES; ++i) {
-            CombatStats* stats = combatPool->get(i);
-            StatusEffects* status = statusPool->get(i);
+// 均匀网格空间索引：每个格子保存实体列表，实体记录所在格子和格内下标，增删移动都是O(1)
+class SpatialGrid {
+private:
+    static constexpr uint32_t NO_CELL = 0xFFFFFFFF;
 
-            if (stats && stats->state != UnitState::DEAD && status) {
-                // 状态效果持续伤害
-                if (status->poisoned) {
-                    stats->health -= 1;
-                    status->effectDuration -= deltaTime;
-                    if (status->effectDuration <= 0) status->poisoned = false;
-                }
+    float cellSize;
+    size_t side;
+    std::vector<std::vector<uint32_t>> cells;
+    std::vector<uint32_t> entityCell;
+    std::vector<uint32_t> entitySlot;
+    size_t population;
 
-                if (status->burning) {
-                    stats->health -= 2;
-                    status->effectDuration -= deltaTime;
-                    if (status->effectDuration <= 0) status->burning = false;
-                }
+    size_t clampCoord(float v) const {
+        if (v <= 0) return 0;
+        size_t c = static_cast<size_t>(v / cellSize);
+        return c < side ? c : side - 1;
+    }
 
-                if (status->stunned) {
-                    status->effectDuration -= deltaTime;
-                    if (status->effectDuration <= 0) status->stunned = false;
-                }
+public:
+    SpatialGrid(float worldSize = WORLD_SIZE, float cell = GRID_CELL_SIZE)
+        : cellSize(cell),
+          side(static_cast<size_t>(std::ceil(worldSize / cell))),
+          cells(side * side),
+          entityCell(MAX_ENTITIES, NO_CELL),
+          entitySlot(MAX_ENTITIES, 0),
+          population(0) {}
 
-                // 检查死亡
-                if (stats->health <= 0) {
-                    stats->state = UnitState::DEAD;
-                    stats->health = 0;
-                }
-            }
-        }
+    size_t cellIndex(float x, float y) const {
+        return clampCoord(y) * side + clampCoord(x);
+    }
 
-        // 处理攻击逻辑
-        for (size_t i = 0; i < MAX_ENTITIES; ++i) {
-            CombatStats* attackerStats = combatPool->get(i);
-            Movement* movement = movementPool->get(i);
-            StatusEffects* status = statusPool ? statusPool->get(i) : nullptr;
+    void insert(size_t entity, float x, float y) {
+        if (entity >= MAX_ENTITIES || entityCell[entity] != NO_CELL) return;
+        size_t cell = cellIndex(x, y);
+        entityCell[entity] = static_cast<uint32_t>(cell);
+        entitySlot[entity] = static_cast<uint32_t>(cells[cell].size());
+        cells[cell].push_back(static_cast<uint32_t>(entity));
+        population++;
+    }
 
-            if (!attackerStats || attackerStats->state == UnitState::DEAD) continue;
-            if (status && status->stunned) continue;
+    void remove(size_t entity) {
+        if (entity >= MAX_ENTITIES || entityCell[entity] == NO_CELL) return;
+        std::vector<uint32_t>& list = cells[entityCell[entity]];
+        uint32_t slot = entitySlot[entity];
+        // 与末尾交换后弹出
+        uint32_t last = list.back();
+        list[slot] = last;
+        entitySlot[last] = slot;
+        list.pop_back();
+        entityCell[entity] = NO_CELL;
+        population--;
+    }
 
-            // 更新攻击冷却
-            attackerStats->attackCooldown -= deltaTime;
+    void move(size_t entity, float x, float y) {
+        if (entity >= MAX_ENTITIES || entityCell[entity] == NO_CELL) return;
+        if (cellIndex(x, y) == entityCell[entity]) return;
+        remove(entity);
+        insert(entity, x, y);
+    }
 
-            // 检查攻击状态
-            if (attackerStats->state == UnitState::ATTACKING) {
-                if (movement && movement->targetEntity != -1) {
-                    CombatStats* targetStats = combatPool->get(movement->targetEntity);
+    // 订阅Transform的增删通知，网格在同步点增量更新，不用每帧重建；位置变化从变更追踪里拉取
+    void track(ComponentPool<Transform>* transforms) {
+        transforms->observe(ComponentEvent::ADDED, [this, transforms](const std::vector<uint32_t>& batch) {
+            for (uint32_t e : batch) {
+                if (Transform* t = transforms->get(e)) insert(e, toFloat(t->x), toFloat(t->y));
+            }
+        });
+        transforms->observe(ComponentEvent::REMOVED, [this](const std::vector<uint32_t>& batch) {
+            for (uint32_t e : batch) remove(e);
+        });
+        transforms->enableChangeTracking();
+    }
 
-                    // 检查目标是否有效
-                    if (!targetStats || targetStats->state == UnitState::DEAD) {
-                        attackerStats->state = UnitState::IDLE;
-                        movement->targetEntity = -1;
-                        continue;
-                    }
+    // 以(x,y)所在格子为中心一圈圈向外扫，下一圈不可能更近时停止。
+    // best/bestDistSq既是输入的上界也是输出，方便在多张网格里接着找
+    template<typename Accept>
+    void nearest(Coord x, Coord y, ComponentPool<Transform>* transforms, Accept accept,
+                 uint32_t& best, CoordDistSq& bestDistSq) const {
+        if (population == 0) return;
+        long cx = static_cast<long>(clampCoord(toFloat(x)));
+        long cy = static_cast<long>(clampCoord(toFloat(y)));
+        long last = static_cast<long>(side) - 1;
+        long maxRing = std::max(std::max(cx, last - cx), std::max(cy, last - cy));
 
-                    // 检查是否在攻击范围内
-                    if (inAttackRange(i, movement->targetEntity)) {
-                        movement->velocity = 0; // 停止移动
+        for (long ring = 0; ring <= maxRing; ++ring) {
+            // 第ring圈的格子离查询点至少隔着ring-1个格子
+            float reach = (ring - 1) * cellSize;
+            if (reach > 0 && distSq(toCoord(reach), Coord()) >= bestDistSq) return;
 
-                        // 执行攻击
-                        if (attackerStats->attackCooldown <= 0) {
-                            int damage = calculateDamage(
-                                attackerStats->attack,
-                                targetStats->defense,
-                                attackerStats->damageType
-                            );
-
-                            targetStats->health -= damage;
-                            attackerStats->attackCooldown = 1.0f / attackerStats->attackSpeed;
-
-                            // 30%几率附加状态效果
-                            if (rand() % 100 < 30) {
-                                if (StatusEffects* targetStatus = statusPool->get(movement->targetEntity)) {
-                                    switch(rand() % 3) {
-                                        case 0:
-                                            targetStatus->poisoned = true;
-                                            targetStatus->effectDuration = 3.0f;
-                                            break;
-                                        case 1:
-                                            targetStatus->stunned = true;
-                                            targetStatus->effectDuration = 1.0f;
-                                            break;
-                                        case 2:
-                                            targetStatus->burning = true;
-                                            targetStatus->effectDuration = 4.0f;
-                                            break;
-                                    }
-                                }
-                            }
-                        }
-                    } else {
-                        // 不在攻击范围内，向目标移动
-                        attackerStats->state = UnitState::MOVING;
-                        Transform* targetTransform = transformPool->get(movement->targetEntity);
-                        Transform* selfTransform = transformPool->get(i);
-
-                        if (targetTransform && selfTransform) {
-                            float dx = targetTransform->x - selfTransform->x;
-                            float dy = targetTransform->y - selfTransform->y;
-                            movement->direction = std::atan2(dy, dx);
-                            movement->velocity = 2.0f; // 移动速度
+            for (long dy = -ring; dy <= ring; ++dy) {
+                long gy = cy + dy;
+                if (gy < 0 || gy > last) continue;
+                // 首尾两行整行扫，中间的行只有左右两个格子在这一圈上
+                long step = (dy == -ring || dy == ring) ? 1 : 2 * ring;
+                for (long dx = -ring; dx <= ring; dx += step) {
+                    long gx = cx + dx;
+                    if (gx < 0 || gx > last) continue;
+                    for (uint32_t e : cells[gy * side + gx]) {
+                        Transform* t = transforms->get(e);
+                        if (!t) continue;
+                        CoordDistSq d = distSq(t->x - x, t->y - y);
+                        if (d < bestDistSq && accept(e)) {
+                            bestDistSq = d;
+                            best = e;
                         }
                     }
-                } else {
-                    attackerStats->state = UnitState::IDLE;
                 }
             }
         }
     }
-};
-
-class MovementSystem {
-private:
-    ComponentManager* components;
-
-public:
-    MovementSystem(ComponentManager* cm) : components(cm) {}
-
-    void update(float deltaTime) {
-        auto transformPool = components->getPool<Transform>();
-        auto movementPool = components->getPool<Movement>();
-        auto combatPool = components->getPool<CombatStats>();
-
-        for (size_t i = 0; i < MAX_ENTITIES; ++i) {
-            Transform* transform = transformPool->get(i);
-            Movement* movement = movementPool->get(i);
-            CombatStats* combat = combatPool->get(i);
 
-            if (transform && movement && combat && combat->state != UnitState::DEAD) {
-                // 移动逻辑
-                if (movement->velocity > 0 && combat->state == UnitState::MOVING) {
-                    transform->x += movement->velocity * std::cos(movement->direction) * deltaTime;
-                    transform->y += movement->velocity * std::sin(movement->direction) * deltaTime;
+    // 对(x,y)周围radius以内的每个实体调用fn，只扫和这个范围相交的格子
+    template<typename Fn>
+    void forEachWithin(Coord x, Coord y, float radius, ComponentPool<Transform>* transforms, Fn fn) const {
+        if (population == 0) return;
+        size_t minX = clampCoord(toFloat(x) - radius), maxX = clampCoord(toFloat(x) + radius);
+        size_t minY = clampCoord(toFloat(y) - radius), maxY = clampCoord(toFloat(y) + radius);
+        CoordDistSq limit = distSq(toCoord(radius), Coord());
+        for (size_t gy = minY; gy <= maxY; ++gy) {
+            for (size_t gx = minX; gx <= maxX; ++gx) {
+                for (uint32_t e : cells[gy * side + gx]) {
+                    Transform* t = transforms->get(e);
+                    if (t && distSq(t->x - x, t->y - y) <= limit) fn(e);
                 }
             }
         }
     }
+
+    const std::vector<uint32_t>& cellEntities(size_t cell) const { return cells[cell]; }
+    size_t size() const { return population; }
+    size_t cellCount() const { return cells.size(); }
+    size_t cellsPerSide() const { return side; }
+    float cellCenterX(size_t cell) const { return ((cell % side) + 0.5f) * cellSize; }
+    float cellCenterY(size_t cell) const { return ((cell / side) + 0.5f) * cellSize; }
 };
 
-class AISystem {
+// 每个队伍一张空间网格，找目标时只查敌方队伍的网格，不会挑中友军
+class TeamSpatialIndex {
 private:
-    ComponentManager* components;
-    EntityManager* entities;
+    static constexpr uint8_t NO_TEAM = 0xFF;
+
+    std::vector<SpatialGrid> grids;
+    std::vector<uint8_t> entityTeam;
 
 public:
-    AISystem(ComponentManager* cm, EntityManager* em)
-        : components(cm), entities(em) {}
+    explicit TeamSpatialIndex(size_t teams)
+        : grids(teams), entityTeam(MAX_ENTITIES, NO_TEAM) {}
 
-    void update() {
-        auto combatPool = components->getPool<CombatStats>();
-        auto movementPool = components->getPool<Movement>();
-        auto transformPool = components->getPool<Transform>();
+    // 和SpatialGrid::track一样跟着Transform的增删走；Team要在同一帧的同步点之前挂上
+    void track(ComponentPool<Transform>* transforms, ComponentPool<Team>* teams) {
+        transforms->observe(ComponentEvent::ADDED, [this, transforms, teams](const std::vector<uint32_t>& batch) {
+            for (uint32_t e : batch) {
+                Transform* t = transforms->get(e);
+                Team* team = teams->get(e);
+                if (!t || !team || team->id >= grids.size()) continue;
+                entityTeam[e] = team->id;
+                grids[team->id].insert(e, toFloat(t->x), toFloat(t->y));
+            }
+        });
+        transforms->observe(ComponentEvent::REMOVED, [this](const std::vector<uint32_t>& batch) {
+            for (uint32_t e : batch) {
+                if (entityTeam[e] == NO_TEAM) continue;
+                grids[entityTeam[e]].remove(e);
+                entityTeam[e] = NO_TEAM;
+            }
+        });
+    }
 
-        for (size_t i = 0; i < MAX_ENTITIES; ++i) {
-            CombatStats* stats = combatPool->get(i);
-            Movement* movement = movementPool->get(i);
+    void move(size_t entity, float x, float y) {
+        if (entity < MAX_ENTITIES && entityTeam[entity] != NO_TEAM) grids[entityTeam[entity]].move(entity, x, y);
+    }
 
-            if (!stats || stats->state == UnitState::DEAD) continue;
+    // 离self最近的活着的敌方单位，没有返回Entity::INVALID_INDEX
+    uint32_t nearestEnemy(size_t self, ComponentStore* world) const {
+        auto transformPool = world->getPool<Transform>();
+        auto combatPool = world->getPool<CombatStats>();
+        Transform* origin = transformPool->get(self);
+        if (!origin) return Entity::INVALID_INDEX;
 
-            // 空闲状态单位寻找目标
-            if (stats->state == UnitState::IDLE) {
-                // 随机选择目标
-                size_t target = rand() % MAX_ENTITIES;
-                CombatStats* targetStats = combatPool->get(target);
+        auto alive = [combatPool](uint32_t e) {
+            CombatStats* stats = combatPool->get(e);
+            return stats && stats->state != UnitState::DEAD;
+        };
+        uint32_t best = Entity::INVALID_INDEX;
+        CoordDistSq bestDistSq = std::numeric_limits<CoordDistSq>::max();
+        for (size_t t = 0; t < grids.size(); ++t) {
+            if (t == entityTeam[self]) continue;
+            grids[t].nearest(origin->x, origin->y, transformPool, alive, best, bestDistSq);
+        }
+        return best;
+    }
 
-                // 验证目标有效性
-                if (targetStats && targetStats->state != UnitState::DEAD && target != i) {
-                    movement->targetEntity = target;
-                    stats->state = UnitState::ATTACKING;
-                }
-            }
+    // 对self周围radius以内的每个敌方单位调用fn，死活由调用方判断
+    template<typename Fn>
+    void forEachEnemyWithin(size_t self, float radius, ComponentStore* world, Fn fn) const {
+        auto transformPool = world->getPool<Transform>();
+        Transform* origin = transformPool->get(self);
+        if (!origin) return;
+        for (size_t t = 0; t < grids.size(); ++t) {
+            if (t == entityTeam[self]) continue;
+            grids[t].forEachWithin(origin->x, origin->y, radius, transformPool, fn);
         }
     }
+
+    size_t teamCount() const { return grids.size(); }
+    const SpatialGrid& grid(size_t team) const { return grids[team]; }
 };
 
-class CleanupSystem {
-private:
-    ComponentManager* components;
-    EntityManager* entities;
+// 更新档位：远离关注点或处于安静区域的单位降低AI/移动的更新频率
+enum class UpdateTier : uint8_t {
+    FULL,
+    REDUCED,
+    DORMANT
+};
 
-public: 
-    CleanupSystem(ComponentManager* cm,EntityManager* em) : components(cm),entities(em) {}
-    void update(){
-        auto combatPool = components->getPool<CombatStats>();
-        for(size_t i=0;i<MAX_ENTITIES;++i){
-            CombatStats* stats = combatPool->get(i);
-            if(stats && stats->state == UnitState::DEAD){
-                components->removeAllComponents(i);
-                entities->destroy(i);
-            }
-        }
+const uint32_t LOD_TIER_PERIOD[] = {1, 4, 16};
 
-    }
+struct InterestPoint {
+    float x, y;
 };
 
-class BattleSimulation {
+class LODSystem {
 private:
-    EntityManager entities;
-    ComponentManager components;
-    CombatSystem combat;
-    MovementSystem movement;
-    AISystem ai;
-    CleanupSystem cleanup;
+    ComponentStore* components;
+    const SpatialGrid* grid;
+    std::vector<InterestPoint> interestPoints;
+    std::vector<UpdateTier> cellTiers;
+    std::vector<UpdateTier> entityTiers;
+    size_t tierCounts[3];
+    float fullRadius;
+    float reducedRadius;
+    uint32_t retierInterval;
+    uint32_t frame;
 
-public:
-    BattleSimulation()
-        : combat(&components, &entities),
-          movement(&components),
-          ai(&components, &entities),
-          cleanup(&components, &entities)
-    {
-        components.registerComponent<Transform>();
-        components.registerComponent<CombatStats>();
-        components.registerComponent<Movement>();
-        components.registerComponent<StatusEffects>();
+    UpdateTier tierForCell(size_t cell) const {
+        float cx = grid->cellCenterX(cell);
+        float cy = grid->cellCenterY(cell);
+        float best = -1;
+        for (const InterestPoint& p : interestPoints) {
+            float dx = p.x - cx;
+            float dy = p.y - cy;
+            float d2 = dx*dx + dy*dy;
+            if (best < 0 || d2 < best) best = d2;
+        }
+        if (best <= fullRadius * fullRadius) return UpdateTier::FULL;
+        if (best <= reducedRadius * reducedRadius) return UpdateTier::REDUCED;
+        return UpdateTier::DORMANT;
     }
 
-    void spawnUnit() {
-        size_t entity = entities.create();
-        if (entity == -1) return;
-
-        components.getPool<Transform>()->assign(entity);
-        components.getPool<CombatStats>()->assign(entity);
-        components.getPool<Movement>()->assign(entity);
-        components.getPool<StatusEffects>()->assign(entity);
+    void retier() {
+        auto combatPool = components->getPool<CombatStats>();
+        tierCounts[0] = tierCounts[1] = tierCounts[2] = 0;
 
-        // 随机化单位属性
-        CombatStats* stats = components.getPool<CombatStats>()->get(entity);
-        if (stats) {
-            stats->health = 80 + rand() % 40;
-            stats->maxHealth = stats->health;
-            stats->attack = 5 + rand() % 10;
-            stats->defense = 3 + rand() % 7;
-            stats->attackSpeed = 0.5f + (rand() % 100) / 100.0f;
+        for (size_t cell = 0; cell < grid->cellCount(); ++cell) {
+            const std::vector<uint32_t>& members = grid->cellEntities(cell);
+            if (members.empty()) continue;
 
-            // 随机伤害类型
-            stats->damageType = static_cast<DamageType>(rand() % 3);
+            UpdateTier tier = tierForCell(cell);
+            // 格子里有交战单位就不算安静区域，整格全速更新
+            if (tier != UpdateTier::FULL) {
+                for (uint32_t e : members) {
+                    CombatStats* stats = combatPool->get(e);
+                    if (stats && stats->state == UnitState::ATTACKING) {
+                        tier = UpdateTier::FULL;
+                        break;
+                    }
+                }
+            }
+            cellTiers[cell] = tier;
+            for (uint32_t e : members) {
+                entityTiers[e] = tier;
+            }
+            tierCounts[static_cast<size_t>(tier)] += members.size();
         }
     }
 
-    void spawnUnits(size_t count) {
-        for (size_t i = 0; i < count && entities.count() < MAX_ENTITIES; ++i) {
+public:
+    LODSystem(ComponentStore* cm, const SpatialGrid* g)
+        : components(cm), grid(g),
+          cellTiers(g->cellCount(), UpdateTier::FULL),
+          entityTiers(MAX_ENTITIES, UpdateTier::FULL),
+          tierCounts{0, 0, 0},
+          fullRadius(150.0f), reducedRadius(350.0f),
+          retierInterval(8), frame(0) {}
+
+    void addInterestPoint(float x, float y) { interestPoints.push_back({x, y}); }
+    void clearInterestPoints() {
+        interestPoints.clear();
+        std::fill(entityTiers.begin(), entityTiers.end(), UpdateTier::FULL);
+    }
+    void setRadii(float full, float reduced) {
+        fullRadius = full;
+        reducedRadius = reduced;
+    }
+
+    // 没有关注点时LOD关闭，所有单位全速更新
+    bool enabled() const { return !interestPoints.empty(); }
+
+    void update() {
+        ++frame;
+        if (!enabled()) return;
+        if (frame % retierInterval == 1 || retierInterval == 1) retier();
+    }
+
+    uint32_t period(size_t entity) const {
+        if (!enabled()) return 1;
+        return LOD_TIER_PERIOD[static_cast<size_t>(entityTiers[entity])];
+    }
+
+    // 按实体ID错开更新帧，避免同一档位的单位挤在同一帧
+    bool shouldUpdate(size_t entity) const {
+        uint32_t p = period(entity);
+        return p == 1 || (frame + entity) % p == 0;
+    }
+
+    // 隔N帧更新一次的单位使用N倍的时间步长
+    float scaledDelta(size_t entity, float deltaTime) const {
+        return deltaTime * period(entity);
+    }
+
+    size_t tierCount(UpdateTier tier) const { return tierCounts[static_cast<size_t>(tier)]; }
+};
+
+enum class StatusEffect {
+    POISON,
+    STUN,
+    BURN
+};
+
+// 战斗统计：在状态切换、伤害结算和效果增删时增量维护，读取都是O(1)，不再每帧扫描整个世界
+class BattleStats {
+public:
+    struct Counters {
+        int64_t byState[4];
+        int64_t aliveByType[3];
+        int64_t aliveByTeam[MAX_TEAMS];
+        int64_t healthSum;
+        int64_t effects[3];
+        int64_t damageByType[3];
+        int64_t hits;
+        int64_t spawned;
+        int64_t deaths;
+        int64_t pagedOutByTeam[MAX_TEAMS];  // 换页写到后备文件里的单位，仍然算活着
+    };
+
+private:
+    Counters current;
+    Counters frameStart;
+    Counters lastDelta;
+
+    static bool& flag(StatusEffects& status, StatusEffect effect) {
+        switch (effect) {
+            case StatusEffect::POISON: return status.poisoned;
+            case StatusEffect::STUN: return status.stunned;
+            default: return status.burning;
+        }
+    }
+
+public:
+    BattleStats() : current{}, frameStart{}, lastDelta{} {}
+
+    void onSpawn(const CombatStats& stats, const Team& team) {
+        onImport(stats, team);
+        current.spawned++;
+    }
+
+    // 迁入或换页进来的单位：只恢复存活计数，spawned在它第一次出生时已经算过
+    void onImport(const CombatStats& stats, const Team& team) {
+        current.byState[static_cast<int>(stats.state)]++;
+        current.aliveByType[static_cast<int>(stats.damageType)]++;
+        current.aliveByTeam[team.id]++;
+        current.healthSum += stats.health;
+    }
+
+    // 区域换页：换出去的单位不在内存里，但队伍存活数和胜负仍然算上它
+    void onPageOut(const CombatStats& stats, StatusEffects* status, const Team* team) {
+        onRemove(stats, status, team);
+        if (team) current.pagedOutByTeam[team->id]++;
+    }
+
+    void onPageIn(const CombatStats& stats, const Team& team) {
+        onImport(stats, team);
+        current.pagedOutByTeam[team.id]--;
+    }
+
+    // 直接生成在后备文件里、从没进过内存的单位
+    void onSpawnPagedOut(uint8_t team) {
+        current.pagedOutByTeam[team]++;
+        current.spawned++;
+    }
+
+    // 所有的单位状态切换都走这里
+    void setState(CombatStats& stats, UnitState to) {
+        if (stats.state == to) return;
+        current.byState[static_cast<int>(stats.state)]--;
+        current.byState[static_cast<int>(to)]++;
+        if (to == UnitState::DEAD) {
+            current.aliveByType[static_cast<int>(stats.damageType)]--;
+            current.deaths++;
+        }
+        stats.state = to;
+    }
+
+    void setHealth(CombatStats& stats, int health) {
+        current.healthSum += health - stats.health;
+        stats.health = health;
+    }
+
+    // 攻击命中
+    void applyHit(CombatStats& target, int damage, DamageType source) {
+        setHealth(target, target.health - damage);
+        current.damageByType[static_cast<int>(source)] += damage;
+        current.hits++;
+    }
+
+    void setEffect(StatusEffects& status, StatusEffect effect, bool on) {
+        bool& f = flag(status, effect);
+        if (f == on) return;
+        f = on;
+        current.effects[static_cast<int>(effect)] += on ? 1 : -1;
+    }
+
+    // 实体被清理时扣掉它残留的计数；队伍人数在这里扣，阵亡单位当帧就会被清理
+    void onRemove(const CombatStats& stats, StatusEffects* status, const Team* team) {
+        current.byState[static_cast<int>(stats.state)]--;
+        if (stats.state != UnitState::DEAD) {
+            current.aliveByType[static_cast<int>(stats.damageType)]--;
+        }
+        if (team) current.aliveByTeam[team->id]--;
+        current.healthSum -= stats.health;
+        if (status) {
+            for (int e = 0; e < 3; ++e) {
+                if (flag(*status, static_cast<StatusEffect>(e))) current.effects[e]--;
+            }
+        }
+    }
+
+    // 帧末调用，记录这一帧的变化量供工具逐帧采样
+    void endFrame() {
+        const int64_t* now = reinterpret_cast<const int64_t*>(&current);
+        const int64_t* before = reinterpret_cast<const int64_t*>(&frameStart);
+        int64_t* delta = reinterpret_cast<int64_t*>(&lastDelta);
+        for (size_t i = 0; i < sizeof(Counters) / sizeof(int64_t); ++i) {
+            delta[i] = now[i] - before[i];
+        }
+        frameStart = current;
+    }
+
+    const Counters& totals() const { return current; }
+    const Counters& frameDelta() const { return lastDelta; }
+
+    size_t count(UnitState state) const { return current.byState[static_cast<int>(state)]; }
+    // 存活数包括换页换出去的单位；只看内存里的用resident()
+    size_t alive() const { return resident() + pagedOut(); }
+    size_t resident() const {
+        return current.byState[0] + current.byState[1] + current.byState[2];
+    }
+    size_t pagedOut() const {
+        int64_t n = 0;
+        for (int64_t c : current.pagedOutByTeam) n += c;
+        return static_cast<size_t>(n);
+    }
+    size_t aliveByType(DamageType type) const { return current.aliveByType[static_cast<int>(type)]; }
+    size_t aliveByTeam(size_t team) const { return current.aliveByTeam[team] + current.pagedOutByTeam[team]; }
+    size_t effectCount(StatusEffect effect) const { return current.effects[static_cast<int>(effect)]; }
+    int64_t damageDealt(DamageType type) const { return current.damageByType[static_cast<int>(type)]; }
+    // 只统计内存里的单位，换出去的单位生命值不在healthSum里
+    float averageHealth() const {
+        size_t n = resident();
+        return n ? static_cast<float>(current.healthSum) / n : 0.0f;
+    }
+};
+
+// 帧内临时内存：每个BattleSimulation一块，模拟一帧期间挂到当前线程上，帧末整体reset。
+// 系统里的候选列表、排序键之类的临时数组从这里拿，稳定运行后不再调malloc
+class FrameArena {
+private:
+    StackAllocator stack;
+    size_t highWater;
+    static thread_local FrameArena* active;
+
+public:
+    explicit FrameArena(size_t size = FRAME_ARENA_SIZE) : stack(size), highWater(0) {}
+
+    void* allocate(size_t size, size_t alignment) {
+        void* p = stack.allocate(size, alignment);
+        highWater = std::max(highWater, stack.used());
+        return p;
+    }
+
+    void reset() { stack.reset(); }
+
+    size_t used() const { return stack.used(); }
+    size_t peak() const { return highWater; }
+    size_t capacity() const { return stack.capacity(); }
+
+    // 当前线程正在用的arena，不在Scope里调用是逻辑错误
+    static FrameArena& current() {
+        if (!active) throw std::logic_error("no frame arena is active on this thread");
+        return *active;
+    }
+
+    // 在作用域内把arena挂到当前线程，可以嵌套，退出时恢复外层的
+    class Scope {
+    private:
+        FrameArena* previous;
+
+    public:
+        explicit Scope(FrameArena& arena) : previous(active) { active = &arena; }
+        ~Scope() { active = previous; }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    // 帧内再套一层系统级的临时数据：结束时退回进入时的栈顶，帧级的分配不受影响。
+    // 在这之前分配的数组照常可用，这之后分配的不能带出作用域
+    class Rewind {
+    private:
+        FrameArena& arena;
+        StackAllocator::Marker marker;
+
+    public:
+        explicit Rewind(FrameArena& a = current()) : arena(a), marker(a.stack.getMarker()) {}
+        // 析构不能抛异常，嵌套顺序乱了在调试版断言，发布版不动栈顶
+        ~Rewind() {
+            assert(marker <= arena.stack.getMarker());
+            if (marker <= arena.stack.getMarker()) arena.stack.freeToMarker(marker);
+        }
+
+        Rewind(const Rewind&) = delete;
+        Rewind& operator=(const Rewind&) = delete;
+    };
+};
+
+thread_local FrameArena* FrameArena::active = nullptr;
+
+// 从帧内存分配的定长数组：容量在构造时一次要够，push_back不会扩容，也就不会在arena里留下旧缓冲。
+// 帧末arena整体作废，不跑析构，所以只放平凡类型
+template<typename T>
+class ArenaVector {
+    static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>,
+                  "frame arena memory is dropped without running destructors");
+
+private:
+    T* items;
+    size_t count;
+    size_t limit;
+
+public:
+    explicit ArenaVector(size_t capacity, FrameArena& arena = FrameArena::current())
+        : items(static_cast<T*>(arena.allocate(std::max<size_t>(capacity, 1) * sizeof(T), alignof(T)))),
+          count(0), limit(capacity) {}
+
+    ArenaVector(const ArenaVector&) = delete;
+    ArenaVector& operator=(const ArenaVector&) = delete;
+
+    void push_back(const T& value) {
+        if (count == limit) throw std::length_error("ArenaVector capacity exceeded");
+        items[count++] = value;
+    }
+
+    // 只能在容量以内调整长度，新增的元素填value
+    void resize(size_t n, const T& value = T()) {
+        if (n > limit) throw std::length_error("ArenaVector capacity exceeded");
+        for (size_t i = count; i < n; ++i) items[i] = value;
+        count = n;
+    }
+
+    void clear() { count = 0; }
+    T& operator[](size_t i) { return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+    T* data() { return items; }
+    const T* data() const { return items; }
+    T* begin() { return items; }
+    T* end() { return items + count; }
+    const T* begin() const { return items; }
+    const T* end() const { return items + count; }
+    size_t size() const { return count; }
+    size_t capacity() const { return limit; }
+    bool empty() const { return count == 0; }
+};
+
+// 三缓冲：在DoubleBufferAllocator的基础上多一块缓冲，写者独占back，读者独占front，
+// middle存最新写完的一帧。middle下标和"有新数据"标记打包在一个原子字节里，
+// 双方各自只做一次exchange，互不等待
+class TripleBufferAllocator {
+    public:
+        explicit TripleBufferAllocator(size_t size) : m_size(size), m_back(0), m_front(1), m_middle(2){
+            for (auto& buffer : m_buffers) buffer = std::make_unique<char[]>(size);
+        }
+        // 写者
+        void* back() const {return m_buffers[m_back].get();}
+        void publish() {
+            uint8_t previous = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel);
+            m_back = previous & INDEX_MASK;
+        }
+        // 读者：有新帧就换到front，返回是否换了
+        bool acquire() {
+            if (!(m_middle.load(std::memory_order_relaxed) & FRESH)) return false;
+            uint8_t previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+            m_front = previous & INDEX_MASK;
+            return true;
+        }
+        const void* front() const {return m_buffers[m_front].get();}
+        size_t size() const {return m_size;}
+    private:
+        static constexpr uint8_t INDEX_MASK = 0x3;
+        static constexpr uint8_t FRESH = 0x4;
+
+        std::array<std::unique_ptr<char[]>,3> m_buffers;
+        size_t m_size;
+        uint8_t m_back;
+        uint8_t m_front;
+        std::atomic<uint8_t> m_middle;
+};
+
+// 类型化事件通道：第N帧写者用fetch_add在back缓冲里占槽位(无锁，可多线程写)，
+// 读者只看front缓冲里第N-1帧的事件；帧末swap翻转缓冲并把写计数清零，事件本身不做堆分配。
+// 容量满了的事件丢弃并计数，不会越界
+template<typename T>
+class EventChannel {
+    static_assert(std::is_trivially_copyable_v<T>, "EventChannel stores events as raw bytes");
+    static_assert(alignof(T) <= alignof(std::max_align_t), "event alignment exceeds buffer alignment");
+
+private:
+    DoubleBufferAllocator buffers;
+    size_t capacity;
+    std::atomic<size_t> writeCount;
+    std::atomic<size_t> dropped;
+    size_t readCount;
+
+public:
+    explicit EventChannel(size_t cap)
+        : buffers(cap * sizeof(T)), capacity(cap), writeCount(0), dropped(0), readCount(0) {}
+
+    EventChannel(const EventChannel&) = delete;
+    EventChannel& operator=(const EventChannel&) = delete;
+
+    bool publish(const T& event) {
+        size_t slot = writeCount.fetch_add(1, std::memory_order_relaxed);
+        if (slot >= capacity) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        std::memcpy(static_cast<T*>(buffers.back()) + slot, &event, sizeof(T));
+        return true;
+    }
+
+    // 帧末调用，调用时不能有写者在跑
+    void swap() {
+        readCount = std::min(writeCount.exchange(0, std::memory_order_acq_rel), capacity);
+        buffers.swap();
+    }
+
+    // 上一帧发布的事件
+    const T* begin() const { return static_cast<const T*>(buffers.front()); }
+    const T* end() const { return begin() + readCount; }
+    size_t size() const { return readCount; }
+    size_t maxEvents() const { return capacity; }
+    size_t droppedEvents() const { return dropped.load(std::memory_order_relaxed); }
+};
+
+struct DamageEvent {
+    Entity attacker;
+    Entity target;
+    int amount;
+    DamageType type;
+};
+
+struct DeathEvent {
+    Entity entity;
+    DamageType type;    // 阵亡单位自己的伤害类型
+};
+
+struct StatusEvent {
+    Entity target;
+    StatusEffect effect;
+    float duration;
+};
+
+// 战斗结算发出的事件，每帧最多每个单位一次攻击/一次阵亡，按MAX_ENTITIES定容
+struct CombatEvents {
+    EventChannel<DamageEvent> damage;
+    EventChannel<DeathEvent> deaths;
+    EventChannel<StatusEvent> status;
+
+    CombatEvents() : damage(MAX_ENTITIES), deaths(MAX_ENTITIES), status(MAX_ENTITIES) {}
+
+    void swap() {
+        damage.swap();
+        deaths.swap();
+        status.swap();
+    }
+};
+
+class CombatSystem {
+private:
+    ComponentStore* components;
+    EntityManager* entities;
+    const LODSystem* lod;
+    Random* rng;
+    BattleStats* stats;
+    CombatEvents* events;
+
+    // 攻击循环前批量算好的"攻击者-目标"对，按攻击者下标升序；数组从帧内存分配，长度补齐到8的倍数
+    struct Engagements {
+        ArenaVector<uint32_t> attacker;
+        ArenaVector<uint32_t> target;
+        ArenaVector<Coord> direction;
+        ArenaVector<uint8_t> inRange;
+        size_t count;
+
+        explicit Engagements(size_t capacity)
+            : attacker(capacity), target(capacity), direction(capacity), inRange(capacity), count(0) {}
+    };
+
+    // 收集本帧所有有存活目标的单位，8个一组算射程判定和追击方向。
+    // 只依赖位置，攻击循环里不会变；眩晕、脚本之类的筛选留给攻击循环
+    void batchEngagements(Engagements& engaged) {
+        auto transformPool = components->getPool<Transform>();
+        auto combatPool = components->getPool<CombatStats>();
+        auto movementPool = components->getPool<Movement>();
+        const size_t extent = entities->extent();
+        const size_t capacity = engaged.attacker.capacity();
+
+        // 差值和射程只在这里用，函数返回就退掉
+        FrameArena::Rewind scratch;
+        ArenaVector<Coord> dx(capacity);
+        ArenaVector<Coord> dy(capacity);
+        ArenaVector<Coord> range(capacity);
+        for (size_t i = 0; i < extent; ++i) {
+            CombatStats* unit = combatPool->get(i);
+            Movement* movement = movementPool->get(i);
+            if (!unit || unit->state == UnitState::DEAD || !movement) continue;
+            if (!movement->targetEntity.valid() || !entities->isAlive(movement->targetEntity)) continue;
+            Transform* self = transformPool->get(i);
+            Transform* target = transformPool->get(movement->targetEntity.index);
+            if (!self || !target) continue;
+            engaged.attacker.push_back(static_cast<uint32_t>(i));
+            engaged.target.push_back(movement->targetEntity.index);
+            dx.push_back(target->x - self->x);
+            dy.push_back(target->y - self->y);
+            range.push_back(unit->attackRange);
+        }
+
+        engaged.count = engaged.attacker.size();
+        size_t padded = (engaged.count + FAST_MATH_LANES - 1) / FAST_MATH_LANES * FAST_MATH_LANES;
+        dx.resize(padded);
+        dy.resize(padded);
+        range.resize(padded);
+        engaged.direction.resize(padded);
+        engaged.inRange.resize(padded);
+
+        for (size_t k = 0; k < padded; ++k) {
+            engaged.inRange[k] = distSq(dx[k], dy[k]) <= distSq(range[k], Coord());
+        }
+        for (size_t k = 0; k < padded; k += FAST_MATH_LANES) {
+            coordAtan2x8(&dy[k], &dx[k], &engaged.direction[k]);
+        }
+    }
+
+    void chase(Movement* movement, Coord direction) {
+        movement->direction = direction;
+        movement->velocity = toCoord(2.0f); // 移动速度
+    }
+
+    int calculateDamage(int attack, int defense, DamageType type) {
+        switch(type) {
+            case DamageType::PHYSICAL:
+                return std::max(1, attack - defense/2);
+            case DamageType::MAGIC:
+                return attack + rng->range(attack/2 + 1);
+            case DamageType::TRUE_DAMAGE:
+                return attack;
+            default:
+                return attack;
+        }
+    }
+
+public:
+    CombatSystem(ComponentStore* cm, EntityManager* em, const LODSystem* l, Random* r, BattleStats* bs, CombatEvents* ev)
+        : components(cm), entities(em), lod(l), rng(r), stats(bs), events(ev) {}
+
+    bool inAttackRange(size_t attacker, size_t target) {
+        auto transformPool = components->getPool<Transform>();
+        Transform* t1 = transformPool->get(attacker);
+        Transform* t2 = transformPool->get(target);
+        auto combatPool = components->getPool<CombatStats>();
+        CombatStats* stats = combatPool->get(attacker);
+
+        if (!t1 || !t2 || !stats) return false;
+
+        // 比较距离平方，不开方
+        return distSq(t1->x - t2->x, t1->y - t2->y) <= distSq(stats->attackRange, Coord());
+    }
+
+    // 结算一次攻击：伤害、重置冷却、几率附加状态效果
+    void performAttack(size_t attacker, size_t target) {
+        auto combatPool = components->getPool<CombatStats>();
+        CombatStats* attackerStats = combatPool->get(attacker);
+        CombatStats* targetStats = combatPool->get(target);
+        if (!attackerStats || !targetStats) return;
+
+        int damage = calculateDamage(
+            attackerStats->attack,
+            targetStats->defense,
+            attackerStats->damageType
+        );
+
+        attackerStats->attackCooldown = 1.0f / attackerStats->attackSpeed;
+        events->damage.publish({entities->handle(attacker), entities->handle(target), damage, attackerStats->damageType});
+
+        // 影子单位归邻居分片结算，伤害事件会被转发过去
+        if (components->getPool<Ghost>()->get(target)) return;
+        landHit(target, damage, attackerStats->damageType);
+    }
+
+    // 邻居分片转发过来的命中，攻击者不在本地
+    void receiveRemoteHit(size_t target, int damage, DamageType type) {
+        events->damage.publish({Entity(), entities->handle(target), damage, type});
+        landHit(target, damage, type);
+    }
+
+    // 结算命中：扣血、几率附加状态效果
+    void landHit(size_t target, int damage, DamageType type) {
+        CombatStats* targetStats = components->getPool<CombatStats>()->get(target);
+        auto statusPool = components->getPool<StatusEffects>();
+        if (!targetStats) return;
+        stats->applyHit(*targetStats, damage, type);
+        Entity targetHandle = entities->handle(target);
+
+        // 30%几率附加状态效果
+        if (rng->range(100) < 30) {
+            if (StatusEffects* targetStatus = statusPool->get(target)) {
+                StatusEffect effect = StatusEffect::POISON;
+                switch(rng->range(3)) {
+                    case 0:
+                        effect = StatusEffect::POISON;
+                        targetStatus->effectDuration = 3.0f;
+                        break;
+                    case 1:
+                        effect = StatusEffect::STUN;
+                        targetStatus->effectDuration = 1.0f;
+                        break;
+                    case 2:
+                        effect = StatusEffect::BURN;
+                        targetStatus->effectDuration = 4.0f;
+                        break;
+                }
+                stats->setEffect(*targetStatus, effect, true);
+                events->status.publish({targetHandle, effect, targetStatus->effectDuration});
+            }
+        }
+    }
+
+    BattleStats* battleStats() { return stats; }
+
+    // 朝目标设置移动方向和速度
+    void steerTowards(size_t self, size_t target) {
+        auto transformPool = components->getPool<Transform>();
+        Transform* targetTransform = transformPool->get(target);
+        Transform* selfTransform = transformPool->get(self);
+        Movement* movement = components->getPool<Movement>()->get(self);
+
+        if (targetTransform && selfTransform && movement) {
+            chase(movement, coordAtan2(targetTransform->y - selfTransform->y, targetTransform->x - selfTransform->x));
+        }
+    }
+
+    void update(float deltaTime) {
+        auto combatPool = components->getPool<CombatStats>();
+        auto movementPool = components->getPool<Movement>();
+        auto statusPool = components->getPool<StatusEffects>();
+        auto scriptedPool = components->getPool<ScriptedBehavior>();
+        auto ghostPool = components->getPool<Ghost>();
+        const size_t extent = entities->extent();
+
+        for (size_t i = 0; i < extent; ++i) {
+            CombatStats* unit = combatPool->get(i);
+            StatusEffects* status = statusPool->get(i);
+
+            if (unit && unit->state != UnitState::DEAD && status) {
+                // 状态效果持续伤害
+                if (status->poisoned) {
+                    stats->setHealth(*unit, unit->health - 1);
+                    status->effectDuration -= deltaTime;
+                    if (status->effectDuration <= 0) stats->setEffect(*status, StatusEffect::POISON, false);
+                }
+
+                if (status->burning) {
+                    stats->setHealth(*unit, unit->health - 2);
+                    status->effectDuration -= deltaTime;
+                    if (status->effectDuration <= 0) stats->setEffect(*status, StatusEffect::BURN, false);
+                }
+
+                if (status->stunned) {
+                    status->effectDuration -= deltaTime;
+                    if (status->effectDuration <= 0) stats->setEffect(*status, StatusEffect::STUN, false);
+                }
+
+                // 检查死亡
+                if (unit->health <= 0) {
+                    stats->setState(*unit, UnitState::DEAD);
+                    stats->setHealth(*unit, 0);
+                    combatPool->notifyChanged(i);
+                    events->deaths.publish({entities->handle(i), unit->damageType});
+                }
+            }
+        }
+
+        // 处理攻击逻辑
+        // 容量按8对齐，补齐的尾批也放得下
+        Engagements engaged((extent + FAST_MATH_LANES - 1) / FAST_MATH_LANES * FAST_MATH_LANES);
+        batchEngagements(engaged);
+        size_t cursor = 0;
+        for (size_t i = 0; i < extent; ++i) {
+            CombatStats* attackerStats = combatPool->get(i);
+            Movement* movement = movementPool->get(i);
+            StatusEffects* status = statusPool ? statusPool->get(i) : nullptr;
+
+            if (!attackerStats || attackerStats->state == UnitState::DEAD) continue;
+            if (status && status->stunned) continue;
+            // 协程驱动的单位自己处理冷却和攻击
+            if (scriptedPool && scriptedPool->get(i)) continue;
+            if (ghostPool && ghostPool->get(i)) continue;
+
+            // 更新攻击冷却
+            attackerStats->attackCooldown -= deltaTime;
+
+            // 追击中的远处单位按LOD档位降频
+            if (attackerStats->state == UnitState::MOVING && !lod->shouldUpdate(i)) continue;
+
+            // 检查攻击状态
+            if (attackerStats->state == UnitState::ATTACKING || attackerStats->state == UnitState::MOVING) {
+                if (movement && movement->targetEntity.valid()) {
+                    // 句柄过期说明目标已被清理（槽位可能已被新单位复用），不用去读组件
+                    size_t target = movement->targetEntity.index;
+                    CombatStats* targetStats = entities->isAlive(movement->targetEntity) ? combatPool->get(target) : nullptr;
+
+                    // 检查目标是否有效
+                    if (!targetStats || targetStats->state == UnitState::DEAD) {
+                        stats->setState(*attackerStats, UnitState::IDLE);
+                        movement->targetEntity = Entity();
+                        continue;
+                    }
+
+                    // 检查是否在攻击范围内：批量算过的直接用，本帧中途换了目标的现算
+                    while (cursor < engaged.count && engaged.attacker[cursor] < i) ++cursor;
+                    bool batched = cursor < engaged.count && engaged.attacker[cursor] == i && engaged.target[cursor] == target;
+                    if (batched ? engaged.inRange[cursor] : inAttackRange(i, target)) {
+                        movement->velocity = Coord(); // 停止移动
+                        stats->setState(*attackerStats, UnitState::ATTACKING);
+
+                        // 执行攻击
+                        if (attackerStats->attackCooldown <= 0) {
+                            performAttack(i, target);
+                        }
+                    } else {
+                        // 不在攻击范围内，向目标移动
+                        stats->setState(*attackerStats, UnitState::MOVING);
+                        if (batched) chase(movement, engaged.direction[cursor]);
+                        else steerTowards(i, target);
+                    }
+                } else {
+                    stats->setState(*attackerStats, UnitState::IDLE);
+                }
+            }
+        }
+    }
+};
+
+class MovementSystem {
+private:
+    ComponentStore* components;
+    EntityManager* entities;
+    const LODSystem* lod;
+
+public:
+    MovementSystem(ComponentStore* cm, EntityManager* em, const LODSystem* l)
+        : components(cm), entities(em), lod(l) {}
+
+    // 移动中的单位攒满8个一起算sin/cos，再逐个写回位置
+    void update(float deltaTime) {
+        auto transformPool = components->getPool<Transform>();
+        auto movementPool = components->getPool<Movement>();
+        auto combatPool = components->getPool<CombatStats>();
+        const size_t extent = entities->extent();
+
+        Transform* batch[FAST_MATH_LANES];
+        Coord step[FAST_MATH_LANES];
+        Coord direction[FAST_MATH_LANES];
+        Coord sine[FAST_MATH_LANES];
+        Coord cosine[FAST_MATH_LANES];
+        int pending = 0;
+
+        auto flush = [&]() {
+            coordSinCos8(direction, sine, cosine);
+            for (int k = 0; k < pending; ++k) {
+                batch[k]->x += step[k] * cosine[k];
+                batch[k]->y += step[k] * sine[k];
+            }
+            pending = 0;
+        };
+
+        for (size_t i = 0; i < extent; ++i) {
+            Movement* movement = movementPool->get(i);
+            CombatStats* combat = combatPool->get(i);
+
+            if (movement && combat && combat->state != UnitState::DEAD) {
+                // 移动逻辑
+                if (movement->velocity > Coord() && combat->state == UnitState::MOVING && lod->shouldUpdate(i)) {
+                    Transform* transform = transformPool->write(i);
+                    if (!transform) continue;
+                    batch[pending] = transform;
+                    step[pending] = movement->velocity * toCoord(lod->scaledDelta(i, deltaTime));
+                    direction[pending] = movement->direction;
+                    if (++pending == FAST_MATH_LANES) flush();
+                }
+            }
+        }
+        if (pending > 0) {
+            // 不满8个的尾批，空位填0角度，算完不用
+            for (int k = pending; k < FAST_MATH_LANES; ++k) direction[k] = Coord();
+            flush();
+        }
+    }
+};
+
+// AI分时调度：每帧从游标处轮转处理一段实体，超过微秒预算就停下，下一帧接着处理
+class AISystem {
+private:
+    ComponentStore* components;
+    EntityManager* entities;
+    const LODSystem* lod;
+    const TeamSpatialIndex* teams;
+    BattleStats* battleStats;
+    std::vector<uint32_t> lastDecision;   // 每个实体上次决策的帧号
+    size_t idleCursor;                    // 空闲单位和忙碌单位各自轮转，预算不够时忙碌单位先让
+    size_t busyCursor;
+    uint32_t frame;
+    long long budgetMicros;               // <=0 表示不限预算，每帧扫完一整轮
+    uint32_t revalidateFrames;            // 非空闲单位复查目标的间隔
+    const std::vector<uint8_t>* dormant;  // 区域换页时换进来还没醒的单位，不开换页为空
+    size_t processedLastFrame;
+    uint32_t maxStalenessLastFrame;
+
+    static const size_t BUDGET_CHECK_STRIDE = 64;
+
+    void decide(size_t i, CombatStats* stats, Movement* movement,
+                ComponentPool<CombatStats>* combatPool) {
+        if (stats->state != UnitState::IDLE) {
+            // 复查当前目标，目标失效的单位回到空闲重新找目标
+            CombatStats* targetStats = entities->isAlive(movement->targetEntity) ? combatPool->get(movement->targetEntity.index) : nullptr;
+            if (targetStats && targetStats->state != UnitState::DEAD) return;
+            battleStats->setState(*stats, UnitState::IDLE);
+            movement->targetEntity = Entity();
+            movement->velocity = Coord();
+        }
+
+        // 在敌方队伍的网格里找最近的目标
+        uint32_t target = teams->nearestEnemy(i, components);
+        if (target != Entity::INVALID_INDEX) {
+            movement->targetEntity = entities->handle(target);
+            battleStats->setState(*stats, UnitState::ATTACKING);
+        }
+    }
+
+public:
+    AISystem(ComponentStore* cm, EntityManager* em, const LODSystem* l, const TeamSpatialIndex* ti, BattleStats* bs)
+        : components(cm), entities(em), lod(l), teams(ti), battleStats(bs),
+          lastDecision(MAX_ENTITIES, 0), idleCursor(0), busyCursor(0), frame(0),
+          budgetMicros(0), revalidateFrames(30), dormant(nullptr),
+          processedLastFrame(0), maxStalenessLastFrame(0) {}
+
+    void setBudget(long long micros) { budgetMicros = micros; }
+    void setRevalidateFrames(uint32_t frames) { revalidateFrames = frames ? frames : 1; }
+    void setDormantMask(const std::vector<uint8_t>* mask) { dormant = mask; }
+
+    void update() {
+        auto start = std::chrono::steady_clock::now();
+
+        ++frame;
+        processedLastFrame = 0;
+        maxStalenessLastFrame = 0;
+
+        // 空闲单位优先：先整轮处理到期的空闲单位，预算还有剩才复查忙碌单位的目标
+        size_t visited = 0;
+        if (scan(true, idleCursor, start, visited)) scan(false, busyCursor, start, visited);
+    }
+
+private:
+    // 从cursor处轮转扫一整轮，只处理idle参数对应的那类单位；预算用完返回false，cursor停在下次接着的位置。
+    // 超时检查按两轮合计的访问数计步
+    bool scan(bool idle, size_t& cursor, std::chrono::steady_clock::time_point start, size_t& visited) {
+        auto combatPool = components->getPool<CombatStats>();
+        auto movementPool = components->getPool<Movement>();
+        auto scriptedPool = components->getPool<ScriptedBehavior>();
+
+        const size_t extent = entities->extent();
+        for (size_t n = 0; n < extent; ++n, ++visited) {
+            if (budgetMicros > 0 && visited % BUDGET_CHECK_STRIDE == BUDGET_CHECK_STRIDE - 1) {
+                auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+                if (elapsed >= budgetMicros) return false;
+            }
+
+            size_t i = cursor < extent ? cursor : 0;
+            cursor = (i + 1) % extent;
+
+            CombatStats* stats = combatPool->get(i);
+            Movement* movement = movementPool->get(i);
+            if (!stats || !movement || stats->state == UnitState::DEAD) continue;
+            if ((stats->state == UnitState::IDLE) != idle) continue;
+            if (scriptedPool && scriptedPool->get(i)) continue;
+            if (dormant && (*dormant)[i]) continue;
+
+            // 空闲单位轮到就决策；忙碌单位只在决策过期后复查。远处单位按LOD周期放宽
+            uint32_t staleness = frame - lastDecision[i];
+            uint32_t due = lod->period(i);
+            if (!idle) due *= revalidateFrames;
+            if (staleness < due) continue;
+
+            decide(i, stats, movement, combatPool);
+            lastDecision[i] = frame;
+            ++processedLastFrame;
+            maxStalenessLastFrame = std::max(maxStalenessLastFrame, staleness);
+        }
+        return true;
+    }
+
+public:
+    size_t processed() const { return processedLastFrame; }
+    uint32_t maxStaleness() const { return maxStalenessLastFrame; }
+    uint32_t staleness(size_t entity) const { return frame - lastDecision[entity]; }
+};
+
+// 协程帧池：固定大小的块放进空闲链表复用，行为协程的创建销毁不走全局堆
+class CoroutineFramePool {
+private:
+    static constexpr size_t BLOCK_SIZE = 1024;
+    static constexpr size_t BLOCKS_PER_CHUNK = 256;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    FreeBlock* freeList;
+    std::vector<char*> chunks;
+    size_t inUse;
+    size_t oversized;
+
+    void grow() {
+        char* chunk = static_cast<char*>(malloc(BLOCK_SIZE * BLOCKS_PER_CHUNK));
+        if (!chunk) throw std::bad_alloc();
+        chunks.push_back(chunk);
+        for (size_t i = 0; i < BLOCKS_PER_CHUNK; ++i) {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + i * BLOCK_SIZE);
+            block->next = freeList;
+            freeList = block;
+        }
+    }
+
+public:
+    CoroutineFramePool() : freeList(nullptr), inUse(0), oversized(0) {}
+    ~CoroutineFramePool() {
+        for (char* chunk : chunks) free(chunk);
+    }
+    CoroutineFramePool(const CoroutineFramePool&) = delete;
+    CoroutineFramePool& operator=(const CoroutineFramePool&) = delete;
+
+    // 每个线程一个池子，批量跑多个世界时互不干扰
+    static CoroutineFramePool& local() {
+        thread_local CoroutineFramePool pool;
+        return pool;
+    }
+
+    void* allocate(size_t size) {
+        if (size > BLOCK_SIZE) {
+            ++oversized;
+            return ::operator new(size);
+        }
+        if (!freeList) grow();
+        FreeBlock* block = freeList;
+        freeList = block->next;
+        ++inUse;
+        return block;
+    }
+
+    void deallocate(void* ptr, size_t size) {
+        if (size > BLOCK_SIZE) {
+            ::operator delete(ptr);
+            return;
+        }
+        FreeBlock* block = static_cast<FreeBlock*>(ptr);
+        block->next = freeList;
+        freeList = block;
+        --inUse;
+    }
+
+    size_t framesInUse() const { return inUse; }
+    size_t oversizedFrames() const { return oversized; }
+};
+
+struct UnitBehavior {
+    struct promise_type {
+        UnitBehavior get_return_object() {
+            return UnitBehavior{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        // 创建后先挂起，由调度器第一次恢复
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        static void* operator new(size_t size) {
+            return CoroutineFramePool::local().allocate(size);
+        }
+        static void operator delete(void* ptr, size_t size) {
+            CoroutineFramePool::local().deallocate(ptr, size);
+        }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// 行为协程调度器：协程只在等待的条件满足时被恢复。
+// 等冷却的单位放在按唤醒时间排序的小顶堆里，每帧开销与在等距离的单位数成正比，与世界规模无关
+class BehaviorScheduler {
+public:
+    using Handle = std::coroutine_handle<UnitBehavior::promise_type>;
+
+    struct CooldownAwaiter {
+        BehaviorScheduler* scheduler;
+        float seconds;
+        bool await_ready() const noexcept { return seconds <= 0; }
+        void await_suspend(Handle h) { scheduler->timers.push({scheduler->now + seconds, h}); }
+        void await_resume() const noexcept {}
+    };
+
+    struct RangeAwaiter {
+        BehaviorScheduler* scheduler;
+        Entity self;
+        Entity target;
+        bool inRange;
+        bool await_ready() {
+            if (!scheduler->alive(self) || !scheduler->alive(target)) {
+                inRange = false;
+                return true;
+            }
+            inRange = scheduler->combat->inAttackRange(self.index, target.index);
+            return inRange;
+        }
+        void await_suspend(Handle h) { scheduler->rangeWaiters.push_back({h, this}); }
+        // 返回false表示自己或目标已经死亡
+        bool await_resume() const noexcept { return inRange; }
+    };
+
+    struct NextFrameAwaiter {
+        BehaviorScheduler* scheduler;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(Handle h) { scheduler->ready.push_back(h); }
+        void await_resume() const noexcept {}
+    };
+
+private:
+    struct Timer {
+        double wakeTime;
+        Handle handle;
+        bool operator>(const Timer& other) const { return wakeTime > other.wakeTime; }
+    };
+
+    struct RangeWait {
+        Handle handle;
+        RangeAwaiter* awaiter;
+    };
+
+    ComponentStore* components;
+    EntityManager* entities;
+    CombatSystem* combat;
+    const TeamSpatialIndex* teams;
+    Random* rng;
+    double now;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    std::vector<RangeWait> rangeWaiters;
+    std::vector<Handle> ready;
+    std::vector<Handle> resumeScratch;
+    std::vector<RangeWait> rangeScratch;
+    size_t liveCount;
+    size_t resumedLastFrame;
+
+    void resume(Handle h) {
+        ++resumedLastFrame;
+        h.resume();
+        if (h.done()) {
+            h.destroy();
+            --liveCount;
+        }
+    }
+
+public:
+    BehaviorScheduler(ComponentStore* cm, EntityManager* em, CombatSystem* cs, const TeamSpatialIndex* ti, Random* r)
+        : components(cm), entities(em), combat(cs), teams(ti), rng(r), now(0), liveCount(0), resumedLastFrame(0) {}
+
+    ~BehaviorScheduler() {
+        // 每个挂起的协程只会在一个等待队列里
+        while (!timers.empty()) {
+            timers.top().handle.destroy();
+            timers.pop();
+        }
+        for (RangeWait& w : rangeWaiters) w.handle.destroy();
+        for (Handle h : ready) h.destroy();
+    }
+    BehaviorScheduler(const BehaviorScheduler&) = delete;
+    BehaviorScheduler& operator=(const BehaviorScheduler&) = delete;
+
+    void start(UnitBehavior behavior) {
+        ++liveCount;
+        ready.push_back(behavior.handle);
+    }
+
+    CooldownAwaiter cooldown(float seconds) { return {this, seconds}; }
+    RangeAwaiter inRange(Entity self, Entity target) { return {this, self, target, false}; }
+    NextFrameAwaiter nextFrame() { return {this}; }
+
+    // 句柄检查挡掉已被清理、槽位被复用的实体
+    bool alive(Entity entity) {
+        if (!entities->isAlive(entity)) return false;
+        CombatStats* stats = components->getPool<CombatStats>()->get(entity.index);
+        return stats && stats->state != UnitState::DEAD;
+    }
+
+    ComponentStore* world() { return components; }
+    EntityManager* entityManager() { return entities; }
+    CombatSystem* combatSystem() { return combat; }
+    const TeamSpatialIndex* teamIndex() const { return teams; }
+    Random* random() { return rng; }
+
+    void update(float deltaTime) {
+        now += deltaTime;
+        resumedLastFrame = 0;
+
+        // 冷却到期
+        while (!timers.empty() && timers.top().wakeTime <= now) {
+            Handle h = timers.top().handle;
+            timers.pop();
+            resume(h);
+        }
+
+        // 等待进入攻击范围的单位：顺便修正追击方向
+        rangeScratch.clear();
+        rangeScratch.swap(rangeWaiters);
+        for (RangeWait& w : rangeScratch) {
+            RangeAwaiter* a = w.awaiter;
+            if (!alive(a->self) || !alive(a->target)) {
+                a->inRange = false;
+                resume(w.handle);
+            } else if (combat->inAttackRange(a->self.index, a->target.index)) {
+                a->inRange = true;
+                resume(w.handle);
+            } else {
+                combat->steerTowards(a->self.index, a->target.index);
+                rangeWaiters.push_back(w);
+            }
+        }
+
+        resumeScratch.clear();
+        resumeScratch.swap(ready);
+        for (Handle h : resumeScratch) resume(h);
+    }
+
+    size_t liveBehaviors() const { return liveCount; }
+    size_t resumed() const { return resumedLastFrame; }
+};
+
+// 单位行为：找目标 -> 等进入射程 -> 等冷却 -> 攻击
+UnitBehavior skirmisherBehavior(BehaviorScheduler& sched, Entity self) {
+    ComponentStore* world = sched.world();
+    while (sched.alive(self)) {
+        CombatStats* stats = world->getPool<CombatStats>()->get(self.index);
+        Movement* movement = world->getPool<Movement>()->get(self.index);
+
+        // 被眩晕时整段睡过去
+        StatusEffects* status = world->getPool<StatusEffects>()->get(self.index);
+        if (status && status->stunned) {
+            if (status->effectDuration > 0) co_await sched.cooldown(status->effectDuration);
+            else co_await sched.nextFrame();
+            continue;
+        }
+
+        EntityManager* entities = sched.entityManager();
+        uint32_t pick = sched.teamIndex()->nearestEnemy(self.index, world);
+        Entity target = pick != Entity::INVALID_INDEX ? entities->handle(pick) : Entity();
+        if (!sched.alive(target)) {
+            co_await sched.nextFrame();
+            continue;
+        }
+
+        BattleStats* battleStats = sched.combatSystem()->battleStats();
+        movement->targetEntity = target;
+        battleStats->setState(*stats, UnitState::MOVING);
+        sched.combatSystem()->steerTowards(self.index, target.index);
+        if (!co_await sched.inRange(self, target)) continue;
+
+        while (sched.alive(self) && sched.alive(target)) {
+            stats = world->getPool<CombatStats>()->get(self.index);
+            movement = world->getPool<Movement>()->get(self.index);
+            movement->velocity = Coord();
+
+            // 交战中被眩晕也一样停手，醒了再看目标还在不在
+            status = world->getPool<StatusEffects>()->get(self.index);
+            if (status && status->stunned) {
+                if (status->effectDuration > 0) co_await sched.cooldown(status->effectDuration);
+                else co_await sched.nextFrame();
+                continue;
+            }
+            battleStats->setState(*stats, UnitState::ATTACKING);
+
+            if (stats->attackCooldown > 0) {
+                co_await sched.cooldown(stats->attackCooldown);
+                stats->attackCooldown = 0;
+                continue;
+            }
+            if (!sched.combatSystem()->inAttackRange(self.index, target.index)) break;
+
+            sched.combatSystem()->performAttack(self.index, target.index);
+            if (ScriptedBehavior* tag = world->getPool<ScriptedBehavior>()->get(self.index)) tag->attacks++;
+        }
+
+        if (sched.alive(self)) {
+            stats = world->getPool<CombatStats>()->get(self.index);
+            movement = world->getPool<Movement>()->get(self.index);
+            movement->targetEntity = Entity();
+            battleStats->setState(*stats, UnitState::IDLE);
+        }
+    }
+}
+
+// 订阅CombatStats的修改通知收集阵亡单位，不再扫描整个世界
+class CleanupSystem {
+private:
+    ComponentStore* components;
+    EntityManager* entities;
+    BattleStats* battleStats;
+    std::vector<uint32_t> candidates;
+
+public: 
+    CleanupSystem(ComponentStore* cm,EntityManager* em,BattleStats* bs) : components(cm),entities(em),battleStats(bs) {}
+    // 组件注册完成后调用
+    void track(){
+        components->observe<CombatStats>(ComponentEvent::CHANGED, [this](const std::vector<uint32_t>& batch) {
+            candidates.insert(candidates.end(), batch.begin(), batch.end());
+        });
+    }
+    // 返回本帧清理掉的单位数
+    size_t update(){
+        auto combatPool = components->getPool<CombatStats>();
+        auto statusPool = components->getPool<StatusEffects>();
+        auto teamPool = components->getPool<Team>();
+        size_t removed = 0;
+        for(uint32_t i : candidates){
+            CombatStats* stats = combatPool->get(i);
+            if(stats && stats->state == UnitState::DEAD){
+                battleStats->onRemove(*stats, statusPool->get(i), teamPool->get(i));
+                components->removeAllComponents(i);
+                entities->destroy(entities->handle(i));
+                removed++;
+            }
+        }
+        candidates.clear();
+        return removed;
+    }
+};
+
+struct SnapshotHeader {
+    uint64_t frame;
+    float elapsed;
+    uint32_t count;
+};
+
+// 一帧快照的只读视图，各列按实体对齐
+struct WorldSnapshot {
+    const SnapshotHeader* header;
+    const uint32_t* entity;
+    const float* x;
+    const float* y;
+    const int32_t* health;
+    const uint8_t* state;
+    const uint8_t* team;
+};
+
+// 把活着的实体的几列紧凑写进调用方给的数组，返回写了多少个；帧快照和共享内存导出共用
+uint32_t packUnitColumns(ComponentStore* components, const EntityManager* entities,
+                         uint32_t* entity, float* x, float* y, int32_t* health, uint8_t* state, uint8_t* team) {
+    auto transformPool = components->getPool<Transform>();
+    auto combatPool = components->getPool<CombatStats>();
+    auto teamPool = components->getPool<Team>();
+    const size_t extent = entities->extent();
+    uint32_t count = 0;
+    for (size_t i = 0; i < extent; ++i) {
+        Transform* t = transformPool->get(i);
+        CombatStats* unit = combatPool->get(i);
+        if (!t || !unit) continue;
+        Team* side = teamPool->get(i);
+        entity[count] = static_cast<uint32_t>(i);
+        x[count] = toFloat(t->x);
+        y[count] = toFloat(t->y);
+        health[count] = unit->health;
+        state[count] = static_cast<uint8_t>(unit->state);
+        team[count] = side ? side->id : 0;
+        ++count;
+    }
+    return count;
+}
+
+// 模拟线程每帧末把选中的列紧凑拷进三缓冲的back并发布，观察线程随时拿最新的完整一帧，
+// 两边都不加锁。快照只含活着的实体
+class SnapshotPublisher {
+private:
+    static constexpr size_t COLUMN_ALIGN = 64;
+
+    // 各列在缓冲里的字节偏移，每列按MAX_ENTITIES预留
+    struct Layout {
+        size_t entity, x, y, health, state, team;
+        size_t total;
+    };
+
+    Layout columns;
+    TripleBufferAllocator buffers;
+    uint64_t published;
+
+    static size_t column(size_t& cursor, size_t bytes) {
+        size_t offset = (cursor + COLUMN_ALIGN - 1) / COLUMN_ALIGN * COLUMN_ALIGN;
+        cursor = offset + bytes;
+        return offset;
+    }
+
+    static Layout makeLayout() {
+        Layout l;
+        size_t cursor = sizeof(SnapshotHeader);
+        l.entity = column(cursor, MAX_ENTITIES * sizeof(uint32_t));
+        l.x = column(cursor, MAX_ENTITIES * sizeof(float));
+        l.y = column(cursor, MAX_ENTITIES * sizeof(float));
+        l.health = column(cursor, MAX_ENTITIES * sizeof(int32_t));
+        l.state = column(cursor, MAX_ENTITIES * sizeof(uint8_t));
+        l.team = column(cursor, MAX_ENTITIES * sizeof(uint8_t));
+        l.total = cursor;
+        return l;
+    }
+
+    WorldSnapshot view(const char* base) const {
+        return {
+            reinterpret_cast<const SnapshotHeader*>(base),
+            reinterpret_cast<const uint32_t*>(base + columns.entity),
+            reinterpret_cast<const float*>(base + columns.x),
+            reinterpret_cast<const float*>(base + columns.y),
+            reinterpret_cast<const int32_t*>(base + columns.health),
+            reinterpret_cast<const uint8_t*>(base + columns.state),
+            reinterpret_cast<const uint8_t*>(base + columns.team)
+        };
+    }
+
+public:
+    SnapshotPublisher() : columns(makeLayout()), buffers(columns.total), published(0) {}
+
+    SnapshotPublisher(const SnapshotPublisher&) = delete;
+    SnapshotPublisher& operator=(const SnapshotPublisher&) = delete;
+
+    // 模拟线程，帧末调用
+    void publish(ComponentStore* components, const EntityManager* entities, float elapsed) {
+        char* base = static_cast<char*>(buffers.back());
+        uint32_t count = packUnitColumns(components, entities,
+            reinterpret_cast<uint32_t*>(base + columns.entity),
+            reinterpret_cast<float*>(base + columns.x),
+            reinterpret_cast<float*>(base + columns.y),
+            reinterpret_cast<int32_t*>(base + columns.health),
+            reinterpret_cast<uint8_t*>(base + columns.state),
+            reinterpret_cast<uint8_t*>(base + columns.team));
+
+        SnapshotHeader* header = reinterpret_cast<SnapshotHeader*>(base);
+        header->frame = ++published;
+        header->elapsed = elapsed;
+        header->count = count;
+        buffers.publish();
+    }
+
+    // 观察线程：返回最新发布的一帧，视图在下一次调用latest前有效；还没发布过返回false
+    bool latest(WorldSnapshot& out) {
+        buffers.acquire();
+        WorldSnapshot snapshot = view(static_cast<const char*>(buffers.front()));
+        if (snapshot.header->frame == 0) return false;
+        out = snapshot;
+        return true;
+    }
+
+    size_t bytesPerBuffer() const { return columns.total; }
+};
+
+// 把同样几列发布到POSIX共享内存段，外部进程用include/shm_world.h里的ShmWorldReader只读映射。
+// 写的过程被sequence的奇偶夹住，读者发现版本变了就重读
+class ShmWorldExporter {
+private:
+    std::string name;
+    int fd;
+    char* base;
+    ShmWorldHeader* header;
+
+public:
+    explicit ShmWorldExporter(const std::string& segment)
+        : name(segment), fd(-1), base(nullptr), header(nullptr) {}
+
+    ~ShmWorldExporter() {
+        if (base) munmap(base, header->totalSize);
+        if (fd >= 0) {
+            close(fd);
+            shm_unlink(name.c_str());
+        }
+    }
+
+    ShmWorldExporter(const ShmWorldExporter&) = delete;
+    ShmWorldExporter& operator=(const ShmWorldExporter&) = delete;
+
+    // 创建(或复用上次残留的)段并初始化头，失败返回false
+    bool open() {
+        ShmWorldHeader layout;
+        shmWorldLayout(layout, static_cast<uint32_t>(MAX_ENTITIES));
+
+        fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+        if (fd < 0) return false;
+        void* p = MAP_FAILED;
+        if (ftruncate(fd, static_cast<off_t>(layout.totalSize)) == 0) {
+            p = mmap(nullptr, layout.totalSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (p == MAP_FAILED) {
+            close(fd);
+            shm_unlink(name.c_str());
+            fd = -1;
+            return false;
+        }
+        base = static_cast<char*>(p);
+        header = new (base) ShmWorldHeader();
+        shmWorldLayout(*header, static_cast<uint32_t>(MAX_ENTITIES));
+        return true;
+    }
+
+    void publish(ComponentStore* components, const EntityManager* entities, uint64_t frame, float elapsed) {
+        uint64_t sequence = header->sequence.load(std::memory_order_relaxed);
+        header->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        uint32_t count = packUnitColumns(components, entities,
+            reinterpret_cast<uint32_t*>(base + header->entityOffset),
+            reinterpret_cast<float*>(base + header->xOffset),
+            reinterpret_cast<float*>(base + header->yOffset),
+            reinterpret_cast<int32_t*>(base + header->healthOffset),
+            reinterpret_cast<uint8_t*>(base + header->stateOffset),
+            reinterpret_cast<uint8_t*>(base + header->teamOffset));
+        header->frame.store(frame, std::memory_order_relaxed);
+        header->elapsed.store(elapsed, std::memory_order_relaxed);
+        header->count.store(count, std::memory_order_relaxed);
+
+        header->sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    const std::string& segment() const { return name; }
+};
+
+// 一场战斗的结果，批量蒙特卡洛模拟用来汇总平衡性数据
+struct BattleOutcome {
+    uint64_t seed;
+    int frames;
+    float duration;
+    size_t survivors;
+    size_t survivorsByType[3];
+    size_t teams;
+    size_t survivorsByTeam[MAX_TEAMS];
+    int winner;                 // 存活单位最多的队伍，-1表示同归于尽
+    double meanSurvivalTime;    // 阵亡单位的平均存活时间(秒)
+    uint64_t totalDamage;
+    std::array<uint64_t, DAMAGE_HISTOGRAM_BUCKETS> damageHistogram;
+};
+
+// 跨分片传输的单位记录：迁移时带上完整状态，当影子时只用到位置/战斗属性/队伍
+struct UnitRecord {
+    uint32_t index;
+    uint32_t generation;
+    Transform transform;
+    CombatStats combat;
+    Coord velocity;
+    Coord direction;
+    StatusEffects status;
+    uint8_t team;
+};
+
+// 打到影子上的命中，转发给单位所属的分片结算
+struct DamageRecord {
+    uint32_t index;
+    uint32_t generation;
+    int amount;
+    DamageType type;
+};
+
+static_assert(std::is_trivially_copyable_v<UnitRecord>, "UnitRecord is sent as raw bytes");
+static_assert(std::is_trivially_copyable_v<DamageRecord>, "DamageRecord is sent as raw bytes");
+
+// 一帧里经过一条分片边界的全部数据
+struct BorderTraffic {
+    std::vector<UnitRecord> ghosts;
+    std::vector<UnitRecord> migrants;
+    std::vector<DamageRecord> hits;
+
+    void clear() {
+        ghosts.clear();
+        migrants.clear();
+        hits.clear();
+    }
+};
+
+// 本分片负责的x区间[minX, maxX)，两侧有没有邻居
+struct ShardBounds {
+    float minX;
+    float maxX;
+    bool hasNeighbor[2];
+
+    ShardBounds() : minX(0), maxX(WORLD_SIZE), hasNeighbor{false, false} {}
+};
+
+// 区域换页的后备文件：每个区域一段定长槽位(槽头 + UnitRecord数组，和分片迁移同一种格式)，
+// 整个文件MAP_SHARED映射，文件是稀疏的，没写过的槽位不占磁盘
+class RegionBackingFile {
+private:
+    struct SlotHeader {
+        uint32_t count;
+        uint32_t reserved;
+    };
+
+    static constexpr size_t PAGE = 4096;
+
+    int fd;
+    char* base;
+    size_t slotBytes;
+    size_t slots;
+    uint32_t capacity;
+
+    SlotHeader* header(size_t region) const { return reinterpret_cast<SlotHeader*>(base + region * slotBytes); }
+    UnitRecord* records(size_t region) const {
+        return reinterpret_cast<UnitRecord*>(base + region * slotBytes + sizeof(SlotHeader));
+    }
+
+public:
+    RegionBackingFile() : fd(-1), base(nullptr), slotBytes(0), slots(0), capacity(0) {}
+    ~RegionBackingFile() {
+        if (base) munmap(base, slotBytes * slots);
+        if (fd >= 0) ::close(fd);
+    }
+    RegionBackingFile(const RegionBackingFile&) = delete;
+    RegionBackingFile& operator=(const RegionBackingFile&) = delete;
+
+    bool open(const std::string& path, size_t regionCount, uint32_t regionCapacity) {
+        capacity = regionCapacity;
+        slots = regionCount;
+        slotBytes = (sizeof(SlotHeader) + regionCapacity * sizeof(UnitRecord) + PAGE - 1) / PAGE * PAGE;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        if (ftruncate(fd, static_cast<off_t>(slotBytes * slots)) != 0) return false;
+        void* p = mmap(nullptr, slotBytes * slots, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) return false;
+        base = static_cast<char*>(p);
+        return true;
+    }
+
+    uint32_t regionCapacity() const { return capacity; }
+    uint32_t count(size_t region) const { return header(region)->count; }
+
+    // 追加到槽位末尾，放不下返回false
+    bool append(size_t region, const UnitRecord* items, size_t n) {
+        SlotHeader* h = header(region);
+        if (h->count + n > capacity) return false;
+        std::memcpy(records(region) + h->count, items, n * sizeof(UnitRecord));
+        h->count += static_cast<uint32_t>(n);
+        return true;
+    }
+
+    // 读出整个槽位并清空
+    void take(size_t region, std::vector<UnitRecord>& out) {
+        SlotHeader* h = header(region);
+        out.assign(records(region), records(region) + h->count);
+        h->count = 0;
+    }
+
+    // 槽位内容已落到页缓存，把映射页从本进程的常驻内存里放掉
+    void release(size_t region) {
+        size_t used = sizeof(SlotHeader) + count(region) * sizeof(UnitRecord);
+        size_t from = (sizeof(SlotHeader) + PAGE - 1) / PAGE * PAGE;
+        if (used > from) madvise(base + region * slotBytes + from, (used - from) / PAGE * PAGE, MADV_DONTNEED);
+    }
+
+    // 预取线程调用：让内核把槽位前records条记录读进页缓存。只发madvise，不读映射里的字节，
+    // 模拟线程同时在改槽位也不会和它竞争；records由排队时的模拟线程给出
+    void prefetch(size_t region, uint32_t records) const {
+        size_t used = (sizeof(SlotHeader) + records * sizeof(UnitRecord) + PAGE - 1) / PAGE * PAGE;
+        madvise(base + region * slotBytes, used, MADV_WILLNEED);
+    }
+};
+
+// 空间区域的换页策略：有战斗/移动的区域和它周围一圈想要常驻内存，其余区域按最近活跃时间做LRU。
+// 常驻区域数不超过预算：先换出最久没动静的区域腾位置，腾不出来就不再换进，
+// 只有带协程单位的区域不受预算限制。再往外一圈交给后台线程预取
+class RegionPager {
+private:
+    // 排队时记下槽位里的记录数，预取线程不去读模拟线程正在改的槽头
+    struct PrefetchRequest {
+        size_t region;
+        uint32_t records;
+    };
+
+    RegionBackingFile file;
+    size_t side;
+    size_t residentBudget;
+    std::vector<uint8_t> resident;
+    std::vector<uint8_t> wanted;
+    std::vector<uint32_t> lastActive;
+    std::vector<uint32_t> lastPinned;
+
+    std::thread prefetcher;
+    std::mutex queueLock;
+    std::condition_variable queueReady;
+    std::deque<PrefetchRequest> prefetchQueue;
+    bool stopping;
+    std::atomic<size_t> prefetched;
+
+    void prefetchLoop() {
+        std::unique_lock<std::mutex> guard(queueLock);
+        while (true) {
+            queueReady.wait(guard, [this] { return stopping || !prefetchQueue.empty(); });
+            if (stopping) return;
+            PrefetchRequest request = prefetchQueue.front();
+            prefetchQueue.pop_front();
+            guard.unlock();
+            file.prefetch(request.region, request.records);
+            prefetched.fetch_add(1, std::memory_order_relaxed);
+            guard.lock();
+        }
+    }
+
+    // 对(region)周围ring圈以内的每个区域调用fn
+    template<typename Fn>
+    void forEachAround(size_t region, long ring, Fn fn) const {
+        long cx = static_cast<long>(region % side);
+        long cy = static_cast<long>(region / side);
+        long last = static_cast<long>(side) - 1;
+        for (long y = std::max(0L, cy - ring); y <= std::min(last, cy + ring); ++y) {
+            for (long x = std::max(0L, cx - ring); x <= std::min(last, cx + ring); ++x) {
+                fn(static_cast<size_t>(y) * side + static_cast<size_t>(x));
+            }
+        }
+    }
+
+public:
+    RegionPager()
+        : side(static_cast<size_t>(std::ceil(WORLD_SIZE / REGION_SIZE))), residentBudget(0),
+          resident(side * side, 1), wanted(side * side, 0), lastActive(side * side, 0),
+          lastPinned(side * side, 0), stopping(false), prefetched(0) {}
+
+    ~RegionPager() {
+        {
+            std::lock_guard<std::mutex> guard(queueLock);
+            stopping = true;
+        }
+        queueReady.notify_all();
+        if (prefetcher.joinable()) prefetcher.join();
+    }
+
+    bool open(const std::string& path, uint32_t regionCapacity, size_t budget) {
+        if (!file.open(path, side * side, regionCapacity)) return false;
+        residentBudget = budget;
+        prefetcher = std::thread(&RegionPager::prefetchLoop, this);
+        return true;
+    }
+
+    RegionBackingFile& backing() { return file; }
+
+    size_t regionCount() const { return side * side; }
+    size_t regionOf(float x, float y) const {
+        auto clamp = [this](float v) {
+            if (v <= 0) return size_t(0);
+            size_t c = static_cast<size_t>(v / REGION_SIZE);
+            return c < side ? c : side - 1;
+        };
+        return clamp(y) * side + clamp(x);
+    }
+    float regionMinX(size_t region) const { return (region % side) * REGION_SIZE; }
+    float regionMinY(size_t region) const { return (region / side) * REGION_SIZE; }
+
+    bool isResident(size_t region) const { return resident[region] != 0; }
+    void setResident(size_t region, bool on) { resident[region] = on ? 1 : 0; }
+    void markActive(size_t region, uint32_t frame) { lastActive[region] = frame; }
+    // 区域里有换不出去的单位(协程/影子)，这一轮必须常驻
+    void markPinned(size_t region, uint32_t frame) { lastActive[region] = lastPinned[region] = frame; }
+
+    // 根据这一轮标记的活跃区域算出要换进和换出的区域；活跃区域外第二圈排进预取队列
+    // load/evict的容量至少要有regionCount()
+    void plan(uint32_t frame, ArenaVector<size_t>& load, ArenaVector<size_t>& evict) {
+        load.clear();
+        evict.clear();
+        std::fill(wanted.begin(), wanted.end(), 0);
+        // 相邻活跃区域的第二圈会重叠，每个区域只排一次预取
+        FrameArena::Rewind scratch;
+        ArenaVector<PrefetchRequest> prefetch(regionCount());
+        ArenaVector<uint8_t> queued(regionCount());
+        queued.resize(regionCount(), 0);
+        for (size_t r = 0; r < regionCount(); ++r) {
+            if (lastActive[r] != frame) continue;
+            forEachAround(r, 1, [this](size_t n) { wanted[n] = 1; });
+            forEachAround(r, 2, [this, &prefetch, &queued](size_t n) {
+                if (resident[n] || queued[n] || file.count(n) == 0) return;
+                queued[n] = 1;
+                prefetch.push_back({n, file.count(n)});
+            });
+        }
+
+        size_t residentCount = 0;
+        ArenaVector<size_t> missing(regionCount());
+        ArenaVector<size_t> candidates(regionCount());
+        for (size_t r = 0; r < regionCount(); ++r) {
+            if (resident[r]) residentCount++;
+            if (wanted[r] && !resident[r]) missing.push_back(r);
+            if (resident[r] && !wanted[r]) candidates.push_back(r);
+        }
+        // 换进的先后：必须常驻的、本轮活跃的、最后是活跃区域周围那一圈
+        auto rank = [this, frame](size_t r) { return lastPinned[r] == frame ? 0 : lastActive[r] == frame ? 1 : 2; };
+        std::stable_sort(missing.begin(), missing.end(), [&rank](size_t a, size_t b) { return rank(a) < rank(b); });
+        std::sort(candidates.begin(), candidates.end(),
+                  [this](size_t a, size_t b) { return lastActive[a] < lastActive[b]; });
+        for (size_t r : candidates) {
+            if (residentCount + missing.size() <= residentBudget) break;
+            evict.push_back(r);
+            residentCount--;
+        }
+        for (size_t r : missing) {
+            if (residentCount >= residentBudget && lastPinned[r] != frame) break;
+            load.push_back(r);
+            residentCount++;
+        }
+
+        if (!prefetch.empty()) {
+            std::lock_guard<std::mutex> guard(queueLock);
+            prefetchQueue.insert(prefetchQueue.end(), prefetch.begin(), prefetch.end());
+            queueReady.notify_one();
+        }
+    }
+
+    size_t residentRegions() const { return static_cast<size_t>(std::count(resident.begin(), resident.end(), 1)); }
+    size_t prefetchedRegions() const { return prefetched.load(std::memory_order_relaxed); }
+};
+
+// simulateBattle每帧的阶段，遥测按阶段上报耗时
+enum class SimStage {
+    LOD,
+    AI,
+    BEHAVIORS,
+    COMBAT,
+    MOVEMENT,
+    SYNC,
+    CLEANUP,
+    PUBLISH,
+    COUNT
+};
+
+const size_t SIM_STAGE_COUNT = static_cast<size_t>(SimStage::COUNT);
+const char* const SIM_STAGE_NAMES[SIM_STAGE_COUNT] = {
+    "lod", "ai", "behaviors", "combat", "movement", "sync", "cleanup", "publish"
+};
+
+// 遥测用的组件池，顺序和名字一一对应
+const size_t TELEMETRY_POOL_COUNT = 7;
+const char* const TELEMETRY_POOL_NAMES[TELEMETRY_POOL_COUNT] = {
+    "transform", "combat", "movement", "status", "scripted", "team", "ghost"
+};
+
+// 模拟线程每帧写、遥测线程随时读的计数器。每个字段单独原子、relaxed读写，模拟线程从不等锁；
+// 代价是一次读到的各字段可能跨了帧，监控用够了。C++20起std::atomic默认构造即为0
+struct TelemetryCounters {
+    std::atomic<uint64_t> frame;
+    std::atomic<float> elapsed;
+    std::atomic<uint64_t> frameNanos;
+    std::atomic<uint64_t> maxFrameNanos;
+    std::atomic<uint64_t> stageNanos[SIM_STAGE_COUNT];
+    std::atomic<uint64_t> entities;
+    std::atomic<uint64_t> extent;
+    std::atomic<uint64_t> alive;
+    std::atomic<uint64_t> attacking;
+    std::atomic<uint64_t> moving;
+    std::atomic<uint64_t> teams;
+    std::atomic<uint64_t> aliveByTeam[MAX_TEAMS];
+    std::atomic<uint64_t> poolUsed[TELEMETRY_POOL_COUNT];
+    std::atomic<uint64_t> poolCapacity;
+    std::atomic<uint64_t> eventsUsed[3];        // 伤害/阵亡/状态通道上一帧的事件数
+    std::atomic<uint64_t> eventCapacity;
+    std::atomic<uint64_t> eventsDropped;
+    std::atomic<uint64_t> eventBufferBytes;     // 三个通道双缓冲总共占的字节
+    std::atomic<uint64_t> arenaUsed;            // 帧内存这一帧用到的字节
+    std::atomic<uint64_t> arenaPeak;
+    std::atomic<uint64_t> arenaCapacity;
+    std::atomic<uint64_t> residentRegions;
+    std::atomic<uint64_t> dormantUnits;
+};
+
+// 给simulateBattle分阶段计时，counters为空(没开遥测)时什么都不做
+class StageClock {
+private:
+    using Clock = std::chrono::steady_clock;
+    TelemetryCounters* counters;
+    Clock::time_point start;
+    Clock::time_point last;
+
+public:
+    explicit StageClock(TelemetryCounters* c) : counters(c) {
+        if (counters) start = last = Clock::now();
+    }
+
+    void lap(SimStage stage) {
+        if (!counters) return;
+        Clock::time_point now = Clock::now();
+        uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+        counters->stageNanos[static_cast<size_t>(stage)].store(nanos, std::memory_order_relaxed);
+        last = now;
+    }
+
+    uint64_t totalNanos() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(last - start).count();
+    }
+};
+
+// 后台遥测服务：在Unix域套接字上监听，每个连接发一行请求("json"返回JSON，其他返回文本)，
+// 回一份指标快照后关闭。例如 echo json | nc -U /tmp/ecs_telemetry.sock
+class TelemetryServer {
+private:
+    std::string path;
+    int listenFd;
+    std::atomic<bool> running;
+    std::thread server;
+    TelemetryCounters data;
+
+    static uint64_t load(const std::atomic<uint64_t>& v) { return v.load(std::memory_order_relaxed); }
+
+    std::string renderText() const {
+        std::ostringstream out;
+        uint64_t frameNanos = load(data.frameNanos);
+        out << "frame " << load(data.frame) << " t=" << data.elapsed.load(std::memory_order_relaxed) << "s\n";
+        out << "frame_ms " << frameNanos / 1e6 << " (max " << load(data.maxFrameNanos) / 1e6 << ")\n";
+        for (size_t s = 0; s < SIM_STAGE_COUNT; ++s) {
+            out << "  " << SIM_STAGE_NAMES[s] << "_ms " << load(data.stageNanos[s]) / 1e6 << "\n";
+        }
+        out << "entities " << load(data.entities) << " (extent " << load(data.extent) << ")\n";
+        out << "alive " << load(data.alive) << " attacking " << load(data.attacking)
+            << " moving " << load(data.moving) << "\n";
+        out << "teams";
+        for (size_t t = 0; t < load(data.teams) && t < MAX_TEAMS; ++t) out << " " << load(data.aliveByTeam[t]);
+        out << "\npools (capacity " << load(data.poolCapacity) << ")";
+        for (size_t p = 0; p < TELEMETRY_POOL_COUNT; ++p) out << " " << TELEMETRY_POOL_NAMES[p] << "=" << load(data.poolUsed[p]);
+        out << "\nevents damage/death/status " << load(data.eventsUsed[0]) << "/" << load(data.eventsUsed[1])
+            << "/" << load(data.eventsUsed[2]) << " of " << load(data.eventCapacity)
+            << ", dropped " << load(data.eventsDropped) << ", buffers " << load(data.eventBufferBytes) << " bytes\n";
+        out << "frame arena " << load(data.arenaUsed) << " bytes (peak " << load(data.arenaPeak)
+            << " of " << load(data.arenaCapacity) << ")\n";
+        out << "regions resident " << load(data.residentRegions) << ", dormant units " << load(data.dormantUnits) << "\n";
+        return out.str();
+    }
+
+    std::string renderJson() const {
+        std::ostringstream out;
+        out << "{\"frame\":" << load(data.frame)
+            << ",\"elapsed\":" << data.elapsed.load(std::memory_order_relaxed)
+            << ",\"frame_ns\":" << load(data.frameNanos)
+            << ",\"max_frame_ns\":" << load(data.maxFrameNanos)
+            << ",\"stages_ns\":{";
+        for (size_t s = 0; s < SIM_STAGE_COUNT; ++s) {
+            out << (s ? "," : "") << "\"" << SIM_STAGE_NAMES[s] << "\":" << load(data.stageNanos[s]);
+        }
+        out << "},\"entities\":" << load(data.entities)
+            << ",\"extent\":" << load(data.extent)
+            << ",\"alive\":" << load(data.alive)
+            << ",\"attacking\":" << load(data.attacking)
+            << ",\"moving\":" << load(data.moving)
+            << ",\"alive_by_team\":[";
+        for (size_t t = 0; t < load(data.teams) && t < MAX_TEAMS; ++t) out << (t ? "," : "") << load(data.aliveByTeam[t]);
+        out << "],\"pools\":{\"capacity\":" << load(data.poolCapacity);
+        for (size_t p = 0; p < TELEMETRY_POOL_COUNT; ++p) out << ",\"" << TELEMETRY_POOL_NAMES[p] << "\":" << load(data.poolUsed[p]);
+        out << "},\"events\":{\"damage\":" << load(data.eventsUsed[0])
+            << ",\"death\":" << load(data.eventsUsed[1])
+            << ",\"status\":" << load(data.eventsUsed[2])
+            << ",\"capacity\":" << load(data.eventCapacity)
+            << ",\"dropped\":" << load(data.eventsDropped)
+            << ",\"buffer_bytes\":" << load(data.eventBufferBytes)
+            << "},\"frame_arena\":{\"used\":" << load(data.arenaUsed)
+            << ",\"peak\":" << load(data.arenaPeak)
+            << ",\"capacity\":" << load(data.arenaCapacity)
+            << "},\"resident_regions\":" << load(data.residentRegions)
+            << ",\"dormant_units\":" << load(data.dormantUnits) << "}\n";
+        return out.str();
+    }
+
+    void serve(int client) {
+        // 请求行最多等100ms，客户端什么都不发就按文本回
+        char request[64] = {};
+        pollfd readable{client, POLLIN, 0};
+        if (poll(&readable, 1, 100) > 0) {
+            ssize_t n = read(client, request, sizeof(request) - 1);
+            if (n < 0) n = 0;
+            request[n] = '\0';
+        }
+        std::string reply = std::strncmp(request, "json", 4) == 0 ? renderJson() : renderText();
+        size_t sent = 0;
+        while (sent < reply.size()) {
+            ssize_t n = send(client, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) break;
+            sent += static_cast<size_t>(n);
+        }
+    }
+
+    void serveLoop() {
+        while (running.load(std::memory_order_relaxed)) {
+            // 带超时地等连接，停止时最多200ms就能退出
+            pollfd ready{listenFd, POLLIN, 0};
+            if (poll(&ready, 1, 200) <= 0) continue;
+            int client = accept(listenFd, nullptr, nullptr);
+            if (client < 0) continue;
+            serve(client);
+            ::close(client);
+        }
+    }
+
+public:
+    explicit TelemetryServer(const std::string& socketPath)
+        : path(socketPath), listenFd(-1), running(false) {}
+
+    ~TelemetryServer() {
+        running = false;
+        if (server.joinable()) server.join();
+        if (listenFd >= 0) {
+            ::close(listenFd);
+            unlink(path.c_str());
+        }
+    }
+
+    TelemetryServer(const TelemetryServer&) = delete;
+    TelemetryServer& operator=(const TelemetryServer&) = delete;
+
+    // 绑定套接字并启动服务线程；路径上残留的旧套接字文件会先删掉
+    bool start() {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) return false;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0) return false;
+        unlink(path.c_str());
+        if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listenFd, 8) != 0) {
+            ::close(listenFd);
+            listenFd = -1;
+            return false;
+        }
+        running = true;
+        server = std::thread(&TelemetryServer::serveLoop, this);
+        return true;
+    }
+
+    TelemetryCounters& counters() { return data; }
+    const std::string& socketPath() const { return path; }
+};
+
+class BattleSimulation {
+private:
+    EntityManager entities;
+    ComponentStore components;
+    SpatialGrid grid;
+    TeamSpatialIndex teams;
+    Random rng;
+    BattleStats stats;
+    CombatEvents events;
+    LODSystem lod;
+    CombatSystem combat;
+    MovementSystem movement;
+    AISystem ai;
+    BehaviorScheduler behaviors;
+    CleanupSystem cleanup;
+    uint64_t seed;
+    float spawnMinX;
+    float spawnMinY;
+    float spawnWidth;
+    float spawnHeight;
+    float elapsed;
+    int frames;
+    size_t deaths;
+    double deathTimeSum;
+    // 分片运行时的边界和邻居影子；不分片时两侧都没有邻居，这些都用不上
+    ShardBounds shard;
+    std::unordered_map<uint64_t, uint32_t> ghostIndex[2];   // 远端句柄id -> 本地影子实体
+    size_t migratedIn;
+    size_t migratedOut;
+    // 区域换页：不开启时为空
+    std::unique_ptr<RegionPager> pager;
+    size_t pagedOutUnits;
+    std::vector<uint8_t> dormant;       // 换页进来还没被打到或被敌人靠近的单位，AI跳过它们
+    // 单次攻击伤害分布，每档DAMAGE_HISTOGRAM_WIDTH点，最后一档包含所有更高的伤害
+    std::array<uint64_t, DAMAGE_HISTOGRAM_BUCKETS> damageHistogram;
+    std::unique_ptr<SnapshotPublisher> snapshots;   // 没有观察者时不拷快照
+    std::unique_ptr<ShmWorldExporter> shmExport;
+    std::unique_ptr<TelemetryServer> telemetry;
+    FrameArena frameArena;      // 系统的帧内临时数组，simulateBattle结束时reset
+
+    // 帧末把计数写进遥测计数器，全是relaxed存储
+    void publishTelemetry(uint64_t frameNanos) {
+        TelemetryCounters& c = telemetry->counters();
+        const auto relaxed = std::memory_order_relaxed;
+        c.frame.store(frames, relaxed);
+        c.elapsed.store(elapsed, relaxed);
+        c.frameNanos.store(frameNanos, relaxed);
+        if (frameNanos > c.maxFrameNanos.load(relaxed)) c.maxFrameNanos.store(frameNanos, relaxed);
+        c.entities.store(entities.count(), relaxed);
+        c.extent.store(entities.extent(), relaxed);
+        c.alive.store(stats.alive(), relaxed);
+        c.attacking.store(stats.count(UnitState::ATTACKING), relaxed);
+        c.moving.store(stats.count(UnitState::MOVING), relaxed);
+        c.teams.store(teams.teamCount(), relaxed);
+        for (size_t t = 0; t < teams.teamCount(); ++t) c.aliveByTeam[t].store(stats.aliveByTeam(t), relaxed);
+
+        const size_t pools[TELEMETRY_POOL_COUNT] = {
+            components.getPool<Transform>()->size(),
+            components.getPool<CombatStats>()->size(),
+            components.getPool<Movement>()->size(),
+            components.getPool<StatusEffects>()->size(),
+            components.getPool<ScriptedBehavior>()->size(),
+            components.getPool<Team>()->size(),
+            components.getPool<Ghost>()->size()
+        };
+        for (size_t p = 0; p < TELEMETRY_POOL_COUNT; ++p) c.poolUsed[p].store(pools[p], relaxed);
+        c.poolCapacity.store(MAX_ENTITIES, relaxed);
+
+        c.eventsUsed[0].store(events.damage.size(), relaxed);
+        c.eventsUsed[1].store(events.deaths.size(), relaxed);
+        c.eventsUsed[2].store(events.status.size(), relaxed);
+        c.eventCapacity.store(events.damage.maxEvents(), relaxed);
+        c.eventsDropped.store(events.damage.droppedEvents() + events.deaths.droppedEvents() + events.status.droppedEvents(), relaxed);
+        c.eventBufferBytes.store(2 * (events.damage.maxEvents() * sizeof(DamageEvent)
+                                    + events.deaths.maxEvents() * sizeof(DeathEvent)
+                                    + events.status.maxEvents() * sizeof(StatusEvent)), relaxed);
+        c.arenaUsed.store(frameArena.used(), relaxed);
+        c.arenaPeak.store(frameArena.peak(), relaxed);
+        c.arenaCapacity.store(frameArena.capacity(), relaxed);
+        c.residentRegions.store(residentRegions(), relaxed);
+        c.dormantUnits.store(pagedOutUnits, relaxed);
+    }
+
+    // 读上一帧的伤害事件累计直方图
+    void consumeDamageEvents() {
+        auto ghostPool = components.getPool<Ghost>();
+        for (const DamageEvent& hit : events.damage) {
+            // 打在影子上的由所属分片统计
+            if (ghostPool->get(hit.target.index)) continue;
+            if (!dormant.empty() && entities.isAlive(hit.target)) dormant[hit.target.index] = 0;
+            size_t bucket = std::min<size_t>(hit.amount / DAMAGE_HISTOGRAM_WIDTH, DAMAGE_HISTOGRAM_BUCKETS - 1);
+            damageHistogram[bucket]++;
+        }
+    }
+
+    // 醒着的单位把警戒半径内休眠的敌人叫醒，不然休眠单位只有挨打才会醒。
+    // 每帧只轮到1/DORMANT_WAKE_STRIDE的单位，几帧的延迟换查询量
+    void wakeDormantUnits() {
+        auto combatPool = components.getPool<CombatStats>();
+        auto ghostPool = components.getPool<Ghost>();
+        const uint32_t phase = static_cast<uint32_t>(frames) % DORMANT_WAKE_STRIDE;
+        const size_t extent = entities.extent();
+        for (size_t i = phase; i < extent; i += DORMANT_WAKE_STRIDE) {
+            if (dormant[i] || ghostPool->get(i)) continue;
+            CombatStats* unit = combatPool->get(i);
+            if (!unit || unit->state == UnitState::DEAD) continue;
+            teams.forEachEnemyWithin(i, DORMANT_AGGRO_RADIUS, &components, [this](uint32_t e) { dormant[e] = 0; });
+        }
+    }
+
+public:
+    // 队伍数限制在[2, MAX_TEAMS]
+    explicit BattleSimulation(uint64_t seed = 1, size_t teamCount = 2)
+        : teams(std::clamp<size_t>(teamCount, 2, MAX_TEAMS)),
+          rng(seed),
+          lod(&components, &grid),
+          combat(&components, &entities, &lod, &rng, &stats, &events),
+          movement(&components, &entities, &lod),
+          ai(&components, &entities, &lod, &teams, &stats),
+          behaviors(&components, &entities, &combat, &teams, &rng),
+          cleanup(&components, &entities, &stats),
+          seed(seed), spawnMinX(0), spawnMinY(0), spawnWidth(WORLD_SIZE), spawnHeight(WORLD_SIZE),
+          elapsed(0), frames(0), deaths(0), deathTimeSum(0),
+          migratedIn(0), migratedOut(0), pagedOutUnits(0), damageHistogram{}
+    {
+        components.registerComponent<Transform>();
+        components.registerComponent<CombatStats>();
+        components.registerComponent<Movement>();
+        components.registerComponent<StatusEffects>();
+        components.registerComponent<ScriptedBehavior>();
+        components.registerComponent<Team>();
+        components.registerComponent<Ghost>();
+        grid.track(components.getPool<Transform>());
+        teams.track(components.getPool<Transform>(), components.getPool<Team>());
+        cleanup.track();
+    }
+
+    Entity spawnUnit() {
+        Entity handle = entities.create();
+        if (!handle.valid()) return handle;
+        size_t entity = handle.index;
+
+        Transform* transform = components.getPool<Transform>()->assign(entity);
+        components.getPool<CombatStats>()->assign(entity);
+        components.getPool<Movement>()->assign(entity);
+        components.getPool<StatusEffects>()->assign(entity);
+        Team* team = components.getPool<Team>()->assign(entity);
+        team->id = static_cast<uint8_t>(rng.range(static_cast<uint32_t>(teams.teamCount())));
+
+        // 随机化单位属性
+        CombatStats* unit = components.getPool<CombatStats>()->get(entity);
+        if (unit) {
+            unit->health = 80 + rng.range(40);
+            unit->maxHealth = unit->health;
+            unit->attack = 5 + rng.range(10);
+            unit->defense = 3 + rng.range(7);
+            unit->attackSpeed = 0.5f + rng.range(100) / 100.0f;
+
+            // 随机伤害类型
+            unit->damageType = static_cast<DamageType>(rng.range(3));
+            stats.onSpawn(*unit, *team);
+        }
+
+        // 随机分布在出生区域内
+        if (transform) {
+            transform->x = toCoord(spawnMinX + rng.uniform() * spawnWidth);
+            transform->y = toCoord(spawnMinY + rng.uniform() * spawnHeight);
+        }
+        return handle;
+    }
+
+    void spawnUnits(size_t count) {
+        for (size_t i = 0; i < count && entities.count() < MAX_ENTITIES; ++i) {
             spawnUnit();
         }
     }
 
-    void simulateBattle(float deltaTime) {
-        ai.update();
-        combat.update(deltaTime);
-        movement.update(deltaTime);
-        cleanup.update();
+    // 生成由协程行为驱动的单位
+    void spawnScriptedUnits(size_t count) {
+        for (size_t i = 0; i < count && entities.count() < MAX_ENTITIES; ++i) {
+            Entity entity = spawnUnit();
+            if (!entity.valid()) return;
+            components.getPool<ScriptedBehavior>()->assign(entity.index);
+            behaviors.start(skirmisherBehavior(behaviors, entity));
+        }
+    }
+
+    void addInterestPoint(float x, float y) { lod.addInterestPoint(x, y); }
+    void setAIBudget(long long micros) { ai.setBudget(micros); }
+    void setAIRevalidateFrames(uint32_t frames) { ai.setRevalidateFrames(frames); }
+
+    // 按比例调整一个队伍所有活着的单位的攻防，平衡性分支用
+    void buffTeam(size_t team, float attackScale, float defenseScale) {
+        auto combatPool = components.getPool<CombatStats>();
+        auto teamPool = components.getPool<Team>();
+        auto ghostPool = components.getPool<Ghost>();
+        const size_t extent = entities.extent();
+        for (size_t i = 0; i < extent; ++i) {
+            CombatStats* unit = combatPool->get(i);
+            Team* side = teamPool->get(i);
+            if (!unit || !side || side->id != team || ghostPool->get(i)) continue;
+            if (unit->state == UnitState::DEAD) continue;
+            unit->attack = std::max(1, static_cast<int>(std::lround(unit->attack * attackScale)));
+            unit->defense = std::max(0, static_cast<int>(std::lround(unit->defense * defenseScale)));
+        }
+    }
+    // 出生区域边长，从战场左下角开始
+    void setSpawnArea(float side) { setSpawnRegion(0, 0, side, side); }
+    void setSpawnRegion(float x, float y, float width, float height) {
+        spawnMinX = std::clamp(x, 0.0f, WORLD_SIZE);
+        spawnMinY = std::clamp(y, 0.0f, WORLD_SIZE);
+        spawnWidth = std::min(width, WORLD_SIZE - spawnMinX);
+        spawnHeight = std::min(height, WORLD_SIZE - spawnMinY);
+    }
+
+    void simulateBattle(float deltaTime) {
+        FrameArena::Scope arenaScope(frameArena);
+        StageClock clock(telemetry ? &telemetry->counters() : nullptr);
+        elapsed += deltaTime;
+        frames++;
+        components.beginFrame();
+        lod.update();
+        clock.lap(SimStage::LOD);
+        if (!dormant.empty()) wakeDormantUnits();
+        ai.update();
+        clock.lap(SimStage::AI);
+        behaviors.update(deltaTime);
+        clock.lap(SimStage::BEHAVIORS);
+        combat.update(deltaTime);
+        clock.lap(SimStage::COMBAT);
+        movement.update(deltaTime);
+        clock.lap(SimStage::MOVEMENT);
+        // 同步点：派发本帧的组件通知（网格增删、阵亡名单），网格按变更列表更新位置
+        components.dispatchEvents();
+        forEachChanged<Transform>(components, [this](size_t entity, Transform& t) {
+            grid.move(entity, toFloat(t.x), toFloat(t.y));
+            teams.move(entity, toFloat(t.x), toFloat(t.y));
+        });
+        clock.lap(SimStage::SYNC);
+        size_t removed = cleanup.update();
+        deaths += removed;
+        deathTimeSum += removed * static_cast<double>(elapsed);
+        clock.lap(SimStage::CLEANUP);
+        stats.endFrame();
+        // 本帧事件翻到读缓冲，订阅者在下一帧之前处理
+        events.swap();
+        consumeDamageEvents();
+        if (snapshots) snapshots->publish(&components, &entities, elapsed);
+        if (shmExport) shmExport->publish(&components, &entities, frames, elapsed);
+        if (pager && frames % REGION_PAGING_PERIOD == 0) pageRegions();
+        clock.lap(SimStage::PUBLISH);
+        if (telemetry) publishTelemetry(clock.totalNanos());
+        frameArena.reset();
+    }
+
+    // 在socketPath上开遥测服务，绑定失败返回false
+    bool enableTelemetry(const std::string& socketPath = TELEMETRY_DEFAULT_PATH) {
+        std::unique_ptr<TelemetryServer> server(new TelemetryServer(socketPath));
+        if (!server->start()) return false;
+        telemetry = std::move(server);
+        return true;
+    }
+
+    // 把没有动静的空间区域换到path的后备文件，常驻区域最多residentBudget个
+    bool enableRegionPaging(const std::string& path, uint32_t regionCapacity, size_t residentBudget) {
+        std::unique_ptr<RegionPager> p(new RegionPager());
+        if (!p->open(path, regionCapacity, residentBudget)) return false;
+        pager = std::move(p);
+        dormant.assign(MAX_ENTITIES, 0);
+        ai.setDormantMask(&dormant);
+        return true;
+    }
+
+    // 直接往后备文件里写休眠单位，不进内存。只写进眼下没有单位的区域，这些区域随后算作已换出
+    size_t seedDormantUnits(size_t perRegion) {
+        if (!pager) return 0;
+        std::vector<uint8_t> occupied(pager->regionCount(), 0);
+        auto transformPool = components.getPool<Transform>();
+        const size_t extent = entities.extent();
+        for (size_t i = 0; i < extent; ++i) {
+            if (Transform* t = transformPool->get(i)) occupied[pager->regionOf(toFloat(t->x), toFloat(t->y))] = 1;
+        }
+
+        size_t written = 0;
+        std::vector<UnitRecord> batch;
+        for (size_t r = 0; r < pager->regionCount(); ++r) {
+            if (occupied[r]) continue;
+            size_t n = std::min<size_t>(perRegion, pager->backing().regionCapacity());
+            batch.clear();
+            for (size_t k = 0; k < n; ++k) {
+                UnitRecord record{};
+                record.transform.x = toCoord(pager->regionMinX(r) + rng.uniform() * REGION_SIZE);
+                record.transform.y = toCoord(pager->regionMinY(r) + rng.uniform() * REGION_SIZE);
+                record.combat.health = 80 + rng.range(40);
+                record.combat.maxHealth = record.combat.health;
+                record.combat.attack = 5 + rng.range(10);
+                record.combat.defense = 3 + rng.range(7);
+                record.combat.attackSpeed = 0.5f + rng.range(100) / 100.0f;
+                record.combat.damageType = static_cast<DamageType>(rng.range(3));
+                record.team = static_cast<uint8_t>(rng.range(static_cast<uint32_t>(teams.teamCount())));
+                batch.push_back(record);
+                stats.onSpawnPagedOut(record.team);
+            }
+            pager->backing().append(r, batch.data(), batch.size());
+            pager->backing().release(r);
+            pager->setResident(r, false);
+            written += n;
+        }
+        pagedOutUnits += written;
+        return written;
+    }
+
+    size_t residentRegions() const { return pager ? pager->residentRegions() : 0; }
+    size_t dormantUnits() const { return pagedOutUnits; }
+
+    // 每帧把世界导出到共享内存段name，段建不起来返回false
+    bool enableSharedMemoryExport(const std::string& name = SHM_WORLD_DEFAULT_NAME) {
+        std::unique_ptr<ShmWorldExporter> exporter(new ShmWorldExporter(name));
+        if (!exporter->open()) return false;
+        shmExport = std::move(exporter);
+        return true;
+    }
+
+    // 打开帧快照发布，返回的发布器交给观察线程读
+    SnapshotPublisher* enableSnapshots() {
+        if (!snapshots) snapshots.reset(new SnapshotPublisher());
+        return snapshots.get();
+    }
+
+    const BattleStats& battleStats() const { return stats; }
+
+    size_t teamsStanding() const {
+        size_t standing = 0;
+        for (size_t t = 0; t < teams.teamCount(); ++t) {
+            if (stats.aliveByTeam(t) > 0) standing++;
+        }
+        return standing;
     }
+    const CombatEvents& combatEvents() const { return events; }
 
     size_t unitCount() const { return entities.count(); }
 
-    void printBattleStatus() {
+    void setShardBounds(const ShardBounds& bounds) { shard = bounds; }
+    size_t ghostCount() const { return ghostIndex[0].size() + ghostIndex[1].size(); }
+    size_t migratedInCount() const { return migratedIn; }
+    size_t migratedOutCount() const { return migratedOut; }
+
+    // 帧末调用：越过边界的单位打包后从本地删掉，靠近边界的打成影子，
+    // 本帧打在影子上的命中按影子所属的一侧分开
+    void collectBorderTraffic(BorderTraffic out[2]) {
+        out[0].clear();
+        out[1].clear();
+        auto transformPool = components.getPool<Transform>();
+        auto combatPool = components.getPool<CombatStats>();
+        auto scriptedPool = components.getPool<ScriptedBehavior>();
+        auto ghostPool = components.getPool<Ghost>();
+
+        const size_t extent = entities.extent();
+        for (size_t i = 0; i < extent; ++i) {
+            Transform* t = transformPool->get(i);
+            CombatStats* unit = combatPool->get(i);
+            if (!t || !unit || unit->state == UnitState::DEAD) continue;
+            // 协程挂在本进程里，脚本单位不跨分片
+            if (ghostPool->get(i) || scriptedPool->get(i)) continue;
+
+            float x = toFloat(t->x);
+            if (shard.hasNeighbor[0] && x < shard.minX) {
+                out[0].migrants.push_back(exportUnit(i));
+                removeUnit(i);
+                migratedOut++;
+            } else if (shard.hasNeighbor[1] && x >= shard.maxX) {
+                out[1].migrants.push_back(exportUnit(i));
+                removeUnit(i);
+                migratedOut++;
+            } else {
+                if (shard.hasNeighbor[0] && x < shard.minX + SHARD_GHOST_WIDTH) out[0].ghosts.push_back(exportUnit(i));
+                if (shard.hasNeighbor[1] && x >= shard.maxX - SHARD_GHOST_WIDTH) out[1].ghosts.push_back(exportUnit(i));
+            }
+        }
+
+        for (const DamageEvent& hit : events.damage) {
+            Ghost* ghost = entities.isAlive(hit.target) ? ghostPool->get(hit.target.index) : nullptr;
+            if (!ghost) continue;
+            out[ghost->side].hits.push_back({ghost->remote.index, ghost->remote.generation, hit.amount, hit.type});
+        }
+    }
+
+    // 处理从side一侧邻居收到的数据：先结算转发来的命中，再接收迁入单位，最后刷新影子
+    void applyBorderTraffic(int side, const BorderTraffic& in) {
+        auto combatPool = components.getPool<CombatStats>();
+        auto ghostPool = components.getPool<Ghost>();
+        for (const DamageRecord& hit : in.hits) {
+            Entity target(hit.index, hit.generation);
+            // 目标可能已经阵亡或者又迁走了，这种命中丢掉
+            CombatStats* unit = entities.isAlive(target) ? combatPool->get(target.index) : nullptr;
+            if (!unit || unit->state == UnitState::DEAD || ghostPool->get(target.index)) continue;
+            combat.receiveRemoteHit(target.index, hit.amount, hit.type);
+        }
+        for (const UnitRecord& record : in.migrants) {
+            if (importUnit(record).valid()) migratedIn++;
+        }
+        syncGhosts(side, in.ghosts);
+    }
+
+private:
+    UnitRecord exportUnit(size_t entity) {
+        UnitRecord record;
+        Entity handle = entities.handle(entity);
+        Movement* movement = components.getPool<Movement>()->get(entity);
+        StatusEffects* status = components.getPool<StatusEffects>()->get(entity);
+        Team* team = components.getPool<Team>()->get(entity);
+        record.index = handle.index;
+        record.generation = handle.generation;
+        record.transform = *components.getPool<Transform>()->get(entity);
+        record.combat = *components.getPool<CombatStats>()->get(entity);
+        record.velocity = movement ? movement->velocity : Coord();
+        record.direction = movement ? movement->direction : Coord();
+        record.status = status ? *status : StatusEffects();
+        record.team = team ? team->id : 0;
+        return record;
+    }
+
+    // 标记有战斗或移动的区域，按换页计划把区域写出、读回。
+    // 换出的区域和走进了非常驻区域的单位都写进所在区域的槽位；换进来的单位先休眠，挨打了才醒
+    void pageRegions() {
+        auto transformPool = components.getPool<Transform>();
+        auto combatPool = components.getPool<CombatStats>();
+        auto ghostPool = components.getPool<Ghost>();
+        auto scriptedPool = components.getPool<ScriptedBehavior>();
+        const uint32_t stamp = static_cast<uint32_t>(frames);
+        const size_t extent = entities.extent();
+        for (size_t i = 0; i < extent; ++i) {
+            Transform* t = transformPool->get(i);
+            CombatStats* unit = combatPool->get(i);
+            if (!t || !unit) continue;
+            size_t region = pager->regionOf(toFloat(t->x), toFloat(t->y));
+            // 协程单位和影子不能换出去，所在区域必须常驻
+            if (scriptedPool->get(i) || ghostPool->get(i)) pager->markPinned(region, stamp);
+            else if (unit->state == UnitState::ATTACKING || unit->state == UnitState::MOVING) pager->markActive(region, stamp);
+        }
+
+        ArenaVector<size_t> load(pager->regionCount());
+        ArenaVector<size_t> evict(pager->regionCount());
+        pager->plan(stamp, load, evict);
+
+        // 本轮结束后不常驻的区域，里面的单位都要写出去：要换出的，加上有单位走进去但没排上换进的
+        ArenaVector<uint8_t> leaving(pager->regionCount());
+        leaving.resize(pager->regionCount(), 0);
+        for (size_t r = 0; r < pager->regionCount(); ++r) leaving[r] = !pager->isResident(r);
+        for (size_t r : evict) leaving[r] = 1;
+        for (size_t r : load) leaving[r] = 0;
+
+        std::vector<std::vector<UnitRecord>> outgoing(pager->regionCount());
+        ArenaVector<uint32_t> exported(extent);
+        for (size_t i = 0; i < extent; ++i) {
+            Transform* t = transformPool->get(i);
+            CombatStats* unit = combatPool->get(i);
+            if (!t || !unit || unit->state == UnitState::DEAD) continue;
+            if (scriptedPool->get(i) || ghostPool->get(i)) continue;
+            size_t region = pager->regionOf(toFloat(t->x), toFloat(t->y));
+            if (!leaving[region]) continue;
+            outgoing[region].push_back(exportUnit(i));
+            exported.push_back(static_cast<uint32_t>(i));
+        }
+        for (size_t r = 0; r < pager->regionCount(); ++r) {
+            if (!leaving[r] || outgoing[r].empty()) continue;
+            if (pager->backing().append(r, outgoing[r].data(), outgoing[r].size())) {
+                pager->backing().release(r);
+                pagedOutUnits += outgoing[r].size();
+            } else {
+                // 槽位放不下：单位留在内存里，区域保持原来的常驻状态，下一轮再试。
+                // 槽位还空着的非常驻区域可以直接算常驻；槽位里有记录的不能，否则那些记录再也换不回来
+                leaving[r] = 0;
+                if (!pager->isResident(r) && pager->backing().count(r) == 0) pager->setResident(r, true);
+            }
+        }
+        for (size_t r : evict) {
+            if (leaving[r]) pager->setResident(r, false);
+        }
+        for (uint32_t i : exported) {
+            Transform* t = transformPool->get(i);
+            if (leaving[pager->regionOf(toFloat(t->x), toFloat(t->y))]) removeUnit(i, true);
+        }
+
+        std::vector<UnitRecord> incoming;
+        for (size_t r : load) {
+            // 装不下就先不换进来，等别的区域腾出位置
+            if (entities.count() + pager->backing().count(r) > MAX_ENTITIES) continue;
+            pager->backing().take(r, incoming);
+            for (UnitRecord& record : incoming) {
+                // 目标不跨换页保存，换进来一律从空闲开始
+                record.combat.state = UnitState::IDLE;
+                record.velocity = Coord();
+                Entity handle = importUnit(record, true);
+                if (handle.valid()) dormant[handle.index] = 1;
+            }
+            pagedOutUnits -= incoming.size();
+            pager->setResident(r, true);
+        }
+        assert(stats.pagedOut() == pagedOutUnits);
+    }
+
+    // 单位离开本进程(迁走或者换页出去)，不算阵亡。换页出去的仍计入队伍存活数
+    void removeUnit(size_t entity, bool pagedOut = false) {
+        if (!dormant.empty()) dormant[entity] = 0;
+        CombatStats* unit = components.getPool<CombatStats>()->get(entity);
+        StatusEffects* status = components.getPool<StatusEffects>()->get(entity);
+        Team* team = components.getPool<Team>()->get(entity);
+        if (pagedOut) stats.onPageOut(*unit, status, team);
+        else stats.onRemove(*unit, status, team);
+        components.removeAllComponents(entity);
+        entities.destroy(entities.handle(entity));
+    }
+
+    // 从记录重建单位(迁入或者换页进来)，目标引用不跨进程，到了之后重新找。实体满了返回无效句柄
+    Entity importUnit(const UnitRecord& record, bool pagedIn = false) {
+        Entity handle = entities.create();
+        if (!handle.valid()) return handle;
+        size_t entity = handle.index;
+
+        *components.getPool<Transform>()->assign(entity) = record.transform;
+        CombatStats* unit = components.getPool<CombatStats>()->assign(entity);
+        *unit = record.combat;
+        Movement* movement = components.getPool<Movement>()->assign(entity);
+        movement->velocity = record.velocity;
+        movement->direction = record.direction;
+        Team* team = components.getPool<Team>()->assign(entity);
+        team->id = record.team;
+        if (pagedIn) stats.onPageIn(*unit, *team);
+        else stats.onImport(*unit, *team);
+
+        // 状态效果走setEffect，计数才能和之后的清除对上
+        StatusEffects* status = components.getPool<StatusEffects>()->assign(entity);
+        status->effectDuration = record.status.effectDuration;
+        if (record.status.poisoned) stats.setEffect(*status, StatusEffect::POISON, true);
+        if (record.status.stunned) stats.setEffect(*status, StatusEffect::STUN, true);
+        if (record.status.burning) stats.setEffect(*status, StatusEffect::BURN, true);
+        return handle;
+    }
+
+    // 用这一帧收到的记录刷新side一侧的影子：已有的就地更新，新的建实体，没再出现的删掉
+    void syncGhosts(int side, const std::vector<UnitRecord>& records) {
+        auto transformPool = components.getPool<Transform>();
         auto combatPool = components.getPool<CombatStats>();
-        size_t alive = 0, attacking = 0, moving = 0;
-
-        for (size_t i = 0; i < MAX_ENTITIES; ++i) {
-            if (CombatStats* stats = combatPool->get(i)) {
-                if (stats->state != UnitState::DEAD) {
-                    alive++;
-                    if (stats->state == UnitState::ATTACKING) attacking++;
-                    if (stats->state == UnitState::MOVING) moving++;
+        auto teamPool = components.getPool<Team>();
+        auto ghostPool = components.getPool<Ghost>();
+        std::unordered_map<uint64_t, uint32_t>& index = ghostIndex[side];
+        const uint32_t stamp = static_cast<uint32_t>(frames);
+
+        for (const UnitRecord& record : records) {
+            Entity remote(record.index, record.generation);
+            auto found = index.find(remote.id());
+            size_t entity;
+            if (found == index.end()) {
+                Entity handle = entities.create();
+                if (!handle.valid()) continue;
+                entity = handle.index;
+                transformPool->assign(entity);
+                combatPool->assign(entity);
+                teamPool->assign(entity);
+                Ghost* ghost = ghostPool->assign(entity);
+                ghost->side = static_cast<uint8_t>(side);
+                ghost->remote = remote;
+                index[remote.id()] = static_cast<uint32_t>(entity);
+            } else {
+                entity = found->second;
+            }
+
+            // 不走write()：下一帧开头会清掉变更列表，这里直接挪网格
+            Transform* t = transformPool->get(entity);
+            *t = record.transform;
+            grid.move(entity, toFloat(t->x), toFloat(t->y));
+            teams.move(entity, toFloat(t->x), toFloat(t->y));
+            *combatPool->get(entity) = record.combat;
+            teamPool->get(entity)->id = record.team;
+            ghostPool->get(entity)->seenFrame = stamp;
+        }
+
+        // 没再出现的影子：离开了边界带、迁了过来或者已经阵亡
+        for (auto it = index.begin(); it != index.end();) {
+            if (ghostPool->get(it->second)->seenFrame != stamp) {
+                components.removeAllComponents(it->second);
+                entities.destroy(entities.handle(it->second));
+                it = index.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+public:
+
+    BattleOutcome outcome() {
+        BattleOutcome result{};
+        result.seed = seed;
+        result.frames = frames;
+        result.duration = elapsed;
+        result.meanSurvivalTime = deaths ? deathTimeSum / deaths : elapsed;
+        result.totalDamage = 0;
+        for (int t = 0; t < 3; ++t) {
+            result.totalDamage += stats.damageDealt(static_cast<DamageType>(t));
+        }
+        result.damageHistogram = damageHistogram;
+        result.survivors = stats.alive();
+        for (int t = 0; t < 3; ++t) {
+            result.survivorsByType[t] = stats.aliveByType(static_cast<DamageType>(t));
+        }
+
+        result.teams = teams.teamCount();
+        result.winner = -1;
+        size_t best = 0;
+        for (size_t t = 0; t < result.teams; ++t) {
+            result.survivorsByTeam[t] = stats.aliveByTeam(t);
+            if (result.survivorsByTeam[t] > best) {
+                best = result.survivorsByTeam[t];
+                result.winner = static_cast<int>(t);
+            }
+        }
+        return result;
+    }
+
+    void printBattleStatus() {
+        const BattleStats::Counters& delta = stats.frameDelta();
+
+        std::cout << "Units: " << stats.alive() << " (teams";
+        for (size_t t = 0; t < teams.teamCount(); ++t) std::cout << " " << stats.aliveByTeam(t);
+        std::cout << ") | "
+                  << "Attacking: " << stats.count(UnitState::ATTACKING) << " | "
+                  << "Moving: " << stats.count(UnitState::MOVING);
+        std::cout << " | Avg HP: " << stats.averageHealth()
+                  << " | Poisoned/Stunned/Burning: " << stats.effectCount(StatusEffect::POISON) << "/"
+                  << stats.effectCount(StatusEffect::STUN) << "/"
+                  << stats.effectCount(StatusEffect::BURN)
+                  << " | Frame hits/deaths: " << delta.hits << "/" << delta.deaths
+                  << " | Events dmg/death/status: " << events.damage.size() << "/"
+                  << events.deaths.size() << "/" << events.status.size()
+                  << " | Moved: " << components.getPool<Transform>()->changedEntities().size();
+        std::cout << " | Scripted: " << behaviors.liveBehaviors()
+                  << " (resumed " << behaviors.resumed() << ")";
+        std::cout << " | AI decisions: " << ai.processed()
+                  << " (max stale " << ai.maxStaleness() << ")";
+        if (lod.enabled()) {
+            std::cout << " | LOD full/reduced/dormant: "
+                      << lod.tierCount(UpdateTier::FULL) << "/"
+                      << lod.tierCount(UpdateTier::REDUCED) << "/"
+                      << lod.tierCount(UpdateTier::DORMANT);
+        }
+        std::cout << std::endl;
+    }
+};
+
+// 帧耗时直方图：对数分桶，每翻一倍分FRACTIONS档，1微秒到约17分钟。
+// 分位数取所在档的上界，误差不超过一档(约9%)；最大值单独精确记录
+class FrameTimeHistogram {
+private:
+    static constexpr int FRACTIONS = 8;
+    static constexpr int BUCKETS = 30 * FRACTIONS;
+
+    std::array<uint64_t, BUCKETS> buckets;
+    uint64_t samples;
+    double total;
+    double maxSeconds;
+
+    static double upperBound(int bucket) { return std::exp2(static_cast<double>(bucket + 1) / FRACTIONS) * 1e-6; }
+
+public:
+    FrameTimeHistogram() : buckets{}, samples(0), total(0), maxSeconds(0) {}
+
+    void record(double seconds) {
+        double micros = std::max(seconds * 1e6, 1.0);
+        int bucket = std::min(static_cast<int>(std::log2(micros) * FRACTIONS), BUCKETS - 1);
+        buckets[bucket]++;
+        samples++;
+        total += seconds;
+        maxSeconds = std::max(maxSeconds, seconds);
+    }
+
+    // q在[0,1]，没有样本时返回0
+    double percentile(double q) const {
+        if (samples == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(std::ceil(q * samples));
+        uint64_t seen = 0;
+        for (int b = 0; b < BUCKETS; ++b) {
+            seen += buckets[b];
+            if (seen >= std::max<uint64_t>(rank, 1)) return std::min(upperBound(b), maxSeconds);
+        }
+        return maxSeconds;
+    }
+
+    uint64_t count() const { return samples; }
+    double mean() const { return samples ? total / samples : 0; }
+    double max() const { return maxSeconds; }
+
+    void print(const char* label) const {
+        std::cout << label << ": " << samples << " samples, mean " << mean() * 1e3 << " ms, p50 "
+                  << percentile(0.5) * 1e3 << " ms, p99 " << percentile(0.99) * 1e3 << " ms, max "
+                  << maxSeconds * 1e3 << " ms" << std::endl;
+    }
+};
+
+// 固定步长的游戏循环：按真实经过的时间往累加器里加，够一步就跑一步模拟。
+// 一轮最多补maxSubsteps步，跟不上时丢掉多出来的时间，避免越追越慢。
+// 剩下不足一步的时间折成插值系数alpha，观察线程用它在上一帧和这一帧之间插值
+class GameLoop {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    BattleSimulation* simulation;
+    float step;
+    int maxSubsteps;
+    double accumulator;
+    Clock::time_point previous;
+    bool started;
+    uint64_t stepCount;
+    double droppedSeconds;
+    std::atomic<float> alpha;
+    FrameTimeHistogram stepTimes;       // 单步模拟耗时
+    FrameTimeHistogram tickTimes;       // 两轮tick之间的真实间隔，含等待
+
+public:
+    GameLoop(BattleSimulation* sim, float fixedStep = 1.0f / 60, int substeps = 5)
+        : simulation(sim), step(fixedStep), maxSubsteps(substeps), accumulator(0),
+          started(false), stepCount(0), droppedSeconds(0), alpha(0) {}
+
+    // 推进一轮，返回这一轮跑了几步模拟
+    int tick() {
+        Clock::time_point now = Clock::now();
+        if (!started) {
+            // 第一轮直接跑一步，之后按真实时间累计
+            started = true;
+            previous = now;
+            accumulator = step;
+        } else {
+            double elapsedSeconds = std::chrono::duration<double>(now - previous).count();
+            tickTimes.record(elapsedSeconds);
+            accumulator += elapsedSeconds;
+            previous = now;
+        }
+
+        int substeps = 0;
+        while (accumulator >= step && substeps < maxSubsteps) {
+            Clock::time_point begin = Clock::now();
+            simulation->simulateBattle(step);
+            stepTimes.record(std::chrono::duration<double>(Clock::now() - begin).count());
+            accumulator -= step;
+            stepCount++;
+            substeps++;
+        }
+        if (accumulator >= step) {
+            // 补不完的部分直接丢掉，只保留一步以内的余量
+            double keep = std::fmod(accumulator, static_cast<double>(step));
+            droppedSeconds += accumulator - keep;
+            accumulator = keep;
+        }
+        alpha.store(static_cast<float>(accumulator / step), std::memory_order_relaxed);
+        return substeps;
+    }
+
+    // 睡到累加器够下一步为止
+    void waitForNextStep() const {
+        double elapsedSeconds = std::chrono::duration<double>(Clock::now() - previous).count();
+        double remaining = step - accumulator - elapsedSeconds;
+        if (remaining > 0) std::this_thread::sleep_for(std::chrono::duration<double>(remaining));
+    }
+
+    // 可以从观察线程读
+    float interpolationAlpha() const { return alpha.load(std::memory_order_relaxed); }
+    uint64_t steps() const { return stepCount; }
+    float fixedStep() const { return step; }
+    double droppedTime() const { return droppedSeconds; }
+    const FrameTimeHistogram& stepHistogram() const { return stepTimes; }
+    const FrameTimeHistogram& tickHistogram() const { return tickTimes; }
+};
+
+// 批量模拟的场景配置，可从key=value格式的文件读取
+struct ScenarioConfig {
+    size_t units;
+    size_t scriptedUnits;
+    int maxFrames;
+    float deltaTime;
+    float spawnArea;
+    size_t stopBelow;
+    long long aiBudgetMicros;
+    size_t teams;
+
+    ScenarioConfig()
+        : units(2000), scriptedUnits(0), maxFrames(1200), deltaTime(0.016f),
+          spawnArea(60.0f), stopBelow(10), aiBudgetMicros(0), teams(2) {}
+
+    bool load(const std::string& path) {
+        std::ifstream in(path);
+        if (!in) return false;
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            size_t eq = line.find('=');
+            if (eq == std::string::npos) continue;
+            std::string key = line.substr(0, eq);
+            std::string value = line.substr(eq + 1);
+            if (key == "units") units = std::stoul(value);
+            else if (key == "scripted_units") scriptedUnits = std::stoul(value);
+            else if (key == "max_frames") maxFrames = std::stoi(value);
+            else if (key == "delta_time") deltaTime = std::stof(value);
+            else if (key == "spawn_area") spawnArea = std::stof(value);
+            else if (key == "stop_below") stopBelow = std::stoul(value);
+            else if (key == "ai_budget_us") aiBudgetMicros = std::stoll(value);
+            else if (key == "teams") teams = std::stoul(value);
+            else std::cerr << "Unknown scenario key: " << key << std::endl;
+        }
+        return true;
+    }
+};
+
+// 无界面批量运行器：每个种子一个独立世界，工作线程从原子计数器领取种子，世界各自持有组件池和随机数
+class BatchRunner {
+private:
+    ScenarioConfig config;
+    unsigned threadCount;
+
+public:
+    BatchRunner(const ScenarioConfig& cfg, unsigned threads)
+        : config(cfg), threadCount(threads ? threads : 1) {}
+
+    BattleOutcome runOne(uint64_t seed) const {
+        // 世界很大(每个组件池MAX_ENTITIES项)，放堆上避免撑爆线程栈
+        std::unique_ptr<BattleSimulation> battle(new BattleSimulation(seed, config.teams));
+        battle->setSpawnArea(config.spawnArea);
+        battle->setAIBudget(config.aiBudgetMicros);
+        battle->spawnUnits(config.units);
+        battle->spawnScriptedUnits(config.scriptedUnits);
+
+        for (int frame = 0; frame < config.maxFrames; ++frame) {
+            battle->simulateBattle(config.deltaTime);
+            if (battle->unitCount() < config.stopBelow) break;
+            // 只剩一个队伍时战斗结束
+            if (battle->teamsStanding() <= 1) break;
+        }
+        return battle->outcome();
+    }
+
+    std::vector<BattleOutcome> run(const std::vector<uint64_t>& seeds) const {
+        std::vector<BattleOutcome> results(seeds.size());
+        std::atomic<size_t> next{0};
+        std::vector<std::thread> workers;
+
+        unsigned n = std::min<size_t>(threadCount, seeds.size());
+        for (unsigned t = 0; t < n; ++t) {
+            workers.emplace_back([&] {
+                while (true) {
+                    size_t index = next.fetch_add(1, std::memory_order_relaxed);
+                    if (index >= seeds.size()) return;
+                    results[index] = runOne(seeds[index]);
                 }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        return results;
+    }
+
+    static void writeCSV(std::ostream& out, const std::vector<BattleOutcome>& results) {
+        out << "seed,frames,duration,survivors,survivors_physical,survivors_magic,survivors_true,"
+            << "teams,winner_team,winner_survivors,mean_survival,total_damage";
+        for (size_t b = 0; b < DAMAGE_HISTOGRAM_BUCKETS; ++b) {
+            out << ",dmg_" << b * DAMAGE_HISTOGRAM_WIDTH;
+        }
+        out << "\n";
+        for (const BattleOutcome& r : results) {
+            out << r.seed << "," << r.frames << "," << r.duration << "," << r.survivors << ","
+                << r.survivorsByType[0] << "," << r.survivorsByType[1] << "," << r.survivorsByType[2] << ","
+                << r.teams << "," << r.winner << "," << (r.winner < 0 ? 0 : r.survivorsByTeam[r.winner]) << ","
+                << r.meanSurvivalTime << "," << r.totalDamage;
+            for (uint64_t count : r.damageHistogram) out << "," << count;
+            out << "\n";
+        }
+    }
+
+    static void writeJSON(std::ostream& out, const std::vector<BattleOutcome>& results, double seconds) {
+        size_t wins[MAX_TEAMS + 1] = {};
+        std::array<uint64_t, DAMAGE_HISTOGRAM_BUCKETS> histogram{};
+        double duration = 0, survival = 0;
+        for (const BattleOutcome& r : results) {
+            wins[r.winner < 0 ? MAX_TEAMS : r.winner]++;
+            duration += r.duration;
+            survival += r.meanSurvivalTime;
+            for (size_t b = 0; b < DAMAGE_HISTOGRAM_BUCKETS; ++b) histogram[b] += r.damageHistogram[b];
+        }
+        size_t n = results.empty() ? 1 : results.size();
+
+        out << "{\n  \"summary\": {\"battles\": " << results.size()
+            << ", \"seconds\": " << seconds
+            << ", \"battles_per_second\": " << (seconds > 0 ? results.size() / seconds : 0)
+            << ", \"team_wins\": [";
+        for (size_t t = 0; t < MAX_TEAMS; ++t) out << (t ? ", " : "") << wins[t];
+        out << "], \"draws\": " << wins[MAX_TEAMS]
+            << ", \"mean_duration\": " << duration / n
+            << ", \"mean_survival\": " << survival / n
+            << ", \"damage_histogram\": [";
+        for (size_t b = 0; b < DAMAGE_HISTOGRAM_BUCKETS; ++b) out << (b ? ", " : "") << histogram[b];
+        out << "]},\n  \"battles\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BattleOutcome& r = results[i];
+            out << "    {\"seed\": " << r.seed << ", \"frames\": " << r.frames
+                << ", \"duration\": " << r.duration << ", \"survivors\": " << r.survivors
+                << ", \"survivors_by_type\": [" << r.survivorsByType[0] << ", "
+                << r.survivorsByType[1] << ", " << r.survivorsByType[2] << "]"
+                << ", \"survivors_by_team\": [";
+            for (size_t t = 0; t < r.teams; ++t) out << (t ? ", " : "") << r.survivorsByTeam[t];
+            out << "], \"winner_team\": " << r.winner
+                << ", \"mean_survival\": " << r.meanSurvivalTime
+                << ", \"total_damage\": " << r.totalDamage << ", \"damage_histogram\": [";
+            for (size_t b = 0; b < DAMAGE_HISTOGRAM_BUCKETS; ++b) out << (b ? ", " : "") << r.damageHistogram[b];
+            out << "]}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+
+    static void printSummary(const std::vector<BattleOutcome>& results, double seconds) {
+        size_t wins[MAX_TEAMS + 1] = {};
+        size_t teams = 0;
+        double duration = 0;
+        for (const BattleOutcome& r : results) {
+            wins[r.winner < 0 ? MAX_TEAMS : r.winner]++;
+            teams = std::max(teams, r.teams);
+            duration += r.duration;
+        }
+        std::cout << "Battles: " << results.size() << " in " << seconds << " s ("
+                  << (seconds > 0 ? results.size() / seconds : 0) << " battles/s)" << std::endl;
+        for (size_t t = 0; t < teams; ++t) {
+            std::cout << "  Team " << t << " wins: " << wins[t] << std::endl;
+        }
+        std::cout << "  Draws: " << wins[MAX_TEAMS] << std::endl;
+        if (!results.empty()) {
+            std::cout << "  Mean duration: " << duration / results.size() << " s" << std::endl;
+        }
+    }
+};
+
+// --batch N [--seed S] [--threads T] [--scenario file] [--out results.csv|results.json]
+int runBatch(int argc, char** argv) {
+    size_t battles = 0;
+    uint64_t firstSeed = 1;
+    unsigned threads = std::thread::hardware_concurrency();
+    std::string outPath;
+    ScenarioConfig config;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--batch" && hasValue) battles = std::stoul(argv[++i]);
+        else if (arg == "--seed" && hasValue) firstSeed = std::stoull(argv[++i]);
+        else if (arg == "--threads" && hasValue) threads = std::stoul(argv[++i]);
+        else if (arg == "--out" && hasValue) outPath = argv[++i];
+        else if (arg == "--scenario" && hasValue) {
+            if (!config.load(argv[++i])) {
+                std::cerr << "Cannot read scenario " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    std::vector<uint64_t> seeds;
+    for (size_t i = 0; i < battles; ++i) seeds.push_back(firstSeed + i);
+
+    BatchRunner runner(config, threads);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<BattleOutcome> results = runner.run(seeds);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    BatchRunner::printSummary(results, seconds);
+    if (!outPath.empty()) {
+        std::ofstream out(outPath);
+        if (!out) {
+            std::cerr << "Cannot write " << outPath << std::endl;
+            return 1;
+        }
+        bool json = outPath.size() >= 5 && outPath.compare(outPath.size() - 5, 5, ".json") == 0;
+        if (json) BatchRunner::writeJSON(out, results, seconds);
+        else BatchRunner::writeCSV(out, results);
+        std::cout << "Results written to " << outPath << std::endl;
+    }
+    return 0;
+}
+
+// 一个what-if分支的改动：给某个队伍加成，或者换AI复查目标的频率
+struct BranchVariant {
+    std::string name;
+    int team;                   // -1表示不加成
+    float attackScale;
+    float defenseScale;
+    uint32_t revalidateFrames;  // 0表示沿用原来的
+
+    BranchVariant(const std::string& n, int t = -1, float attack = 1.0f, float defense = 1.0f, uint32_t revalidate = 0)
+        : name(n), team(t), attackScale(attack), defenseScale(defense), revalidateFrames(revalidate) {}
+};
+
+struct BranchResult {
+    BattleOutcome outcome;
+    long copiedPages;           // 分支里的缺页次数，约等于写时复制实际复制的页数
+    double seconds;
+};
+
+// 用fork(2)把打到一半的世界分成几个分支：子进程和父进程共享所有页，只有被写到的页才复制，
+// 分叉本身几乎不花时间。每个分支应用自己的改动后往下跑frames帧，结果经管道交回。
+// 调用时不能有别的线程在跑(快照观察线程之类)，fork只会带走当前线程
+std::vector<BranchResult> runBranches(BattleSimulation& base, const std::vector<BranchVariant>& variants,
+                                      int frames, float deltaTime) {
+    std::vector<BranchResult> results(variants.size());
+    std::vector<pid_t> children(variants.size(), -1);
+    std::vector<int> pipes(variants.size(), -1);
+    std::cout.flush();
+
+    for (size_t v = 0; v < variants.size(); ++v) {
+        int fds[2];
+        if (pipe(fds) != 0) break;
+        pid_t pid = fork();
+        if (pid < 0) {
+            ::close(fds[0]);
+            ::close(fds[1]);
+            break;
+        }
+        if (pid == 0) {
+            ::close(fds[0]);
+            const BranchVariant& variant = variants[v];
+            struct rusage before;
+            getrusage(RUSAGE_SELF, &before);
+            auto start = std::chrono::steady_clock::now();
+
+            if (variant.team >= 0) base.buffTeam(variant.team, variant.attackScale, variant.defenseScale);
+            if (variant.revalidateFrames) base.setAIRevalidateFrames(variant.revalidateFrames);
+            for (int f = 0; f < frames && base.teamsStanding() > 1; ++f) {
+                base.simulateBattle(deltaTime);
             }
+
+            struct rusage after;
+            getrusage(RUSAGE_SELF, &after);
+            BranchResult result;
+            result.outcome = base.outcome();
+            result.copiedPages = after.ru_minflt - before.ru_minflt;
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            bool ok = ::write(fds[1], &result, sizeof(result)) == sizeof(result);
+            // 不跑析构：世界是从父进程继承来的，拆它只会白白触发更多写时复制
+            _exit(ok ? 0 : 1);
+        }
+        ::close(fds[1]);
+        children[v] = pid;
+        pipes[v] = fds[0];
+    }
+
+    for (size_t v = 0; v < variants.size(); ++v) {
+        if (children[v] < 0) continue;
+        if (::read(pipes[v], &results[v], sizeof(BranchResult)) != sizeof(BranchResult)) {
+            results[v] = BranchResult{};
+            results[v].outcome.winner = -1;
+        }
+        ::close(pipes[v]);
+        waitpid(children[v], nullptr, 0);
+    }
+    return results;
+}
+
+// --what-if [--units U] [--seed S] [--branch-at F] [--horizon H]
+// 跑到第F帧后分出几个平衡性分支，各自再跑H帧，对比结果
+int runWhatIf(int argc, char** argv) {
+    size_t units = 20000;
+    uint64_t seed = 1;
+    int branchAt = 300;
+    int horizon = 600;
+    const float deltaTime = 0.016f;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--units" && hasValue) units = std::stoul(argv[++i]);
+        else if (arg == "--seed" && hasValue) seed = std::stoull(argv[++i]);
+        else if (arg == "--branch-at" && hasValue) branchAt = std::stoi(argv[++i]);
+        else if (arg == "--horizon" && hasValue) horizon = std::stoi(argv[++i]);
+    }
+
+    std::unique_ptr<BattleSimulation> battle(new BattleSimulation(seed));
+    battle->setSpawnArea(std::sqrt(static_cast<float>(units)) * 2.0f);
+    battle->spawnUnits(units);
+    for (int f = 0; f < branchAt; ++f) battle->simulateBattle(deltaTime);
+    std::cout << "Branching at frame " << branchAt << " with " << battle->battleStats().alive()
+              << " units alive" << std::endl;
+
+    std::vector<BranchVariant> variants = {
+        BranchVariant("baseline"),
+        BranchVariant("team0 +20% attack", 0, 1.2f),
+        BranchVariant("team1 +20% attack", 1, 1.2f),
+        BranchVariant("team0 +30% defense", 0, 1.0f, 1.3f),
+        BranchVariant("AI revalidate x6", -1, 1.0f, 1.0f, 5)
+    };
+    auto start = std::chrono::steady_clock::now();
+    std::vector<BranchResult> results = runBranches(*battle, variants, horizon, deltaTime);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t v = 0; v < variants.size(); ++v) {
+        const BattleOutcome& r = results[v].outcome;
+        std::cout << variants[v].name << ": winner team " << r.winner << ", survivors";
+        for (size_t t = 0; t < r.teams; ++t) std::cout << " " << r.survivorsByTeam[t];
+        std::cout << ", damage " << r.totalDamage << ", " << results[v].copiedPages << " pages copied in "
+                  << results[v].seconds << " s" << std::endl;
+    }
+    std::cout << variants.size() << " branches finished in " << seconds << " s" << std::endl;
+    return 0;
+}
+
+// --stream [--active U] [--dormant-per-region D] [--budget B] [--capacity C] [--file path] [--frames F]
+// 中心放一群活跃单位，其余区域塞满休眠单位直接写进后备文件，只有打起来的区域才换进内存
+int runStreaming(int argc, char** argv) {
+    size_t active = 20000;
+    size_t dormantPerRegion = 20000;
+    size_t budget = 16;
+    uint32_t capacity = 65536;
+    std::string path = "/tmp/ecs_regions.bin";
+    int frames = 600;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--active" && hasValue) active = std::stoul(argv[++i]);
+        else if (arg == "--dormant-per-region" && hasValue) dormantPerRegion = std::stoul(argv[++i]);
+        else if (arg == "--budget" && hasValue) budget = std::stoul(argv[++i]);
+        else if (arg == "--capacity" && hasValue) capacity = std::stoul(argv[++i]);
+        else if (arg == "--file" && hasValue) path = argv[++i];
+        else if (arg == "--frames" && hasValue) frames = std::stoi(argv[++i]);
+    }
+
+    std::unique_ptr<BattleSimulation> battle(new BattleSimulation(static_cast<uint64_t>(std::time(nullptr))));
+    if (!battle->enableRegionPaging(path, capacity, budget)) {
+        std::cerr << "Cannot create region file " << path << std::endl;
+        return 1;
+    }
+    battle->setSpawnRegion(WORLD_SIZE * 0.5f - REGION_SIZE, WORLD_SIZE * 0.5f - REGION_SIZE, 2 * REGION_SIZE, 2 * REGION_SIZE);
+    battle->spawnUnits(active);
+    size_t dormant = battle->seedDormantUnits(dormantPerRegion);
+    std::cout << "Active units: " << battle->unitCount() << ", dormant units on disk: " << dormant << std::endl;
+
+    for (int f = 0; f < frames; ++f) {
+        battle->simulateBattle(0.016f);
+        if (f % 60 == 0) {
+            std::cout << "Frame " << f << " - resident units " << battle->unitCount()
+                      << " | dormant " << battle->dormantUnits()
+                      << " | resident regions " << battle->residentRegions() << std::endl;
+        }
+    }
+    return 0;
+}
+
+// 相邻分片之间的一条双向连接(socketpair的一端)。一条消息 = 三个计数 + 影子/迁移单位记录 + 转发的命中
+class ShardLink {
+private:
+    int fd;
+
+    bool writeAll(const void* data, size_t bytes) {
+        const char* p = static_cast<const char*>(data);
+        while (bytes > 0) {
+            ssize_t n = ::write(fd, p, bytes);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            bytes -= static_cast<size_t>(n);
         }
+        return true;
+    }
+
+    bool readAll(void* data, size_t bytes) {
+        char* p = static_cast<char*>(data);
+        while (bytes > 0) {
+            ssize_t n = ::read(fd, p, bytes);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            bytes -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    template<typename T>
+    bool writeArray(const std::vector<T>& items) {
+        return items.empty() || writeAll(items.data(), items.size() * sizeof(T));
+    }
+
+    template<typename T>
+    bool readArray(std::vector<T>& items, uint32_t count) {
+        items.resize(count);
+        return count == 0 || readAll(items.data(), count * sizeof(T));
+    }
+
+public:
+    explicit ShardLink(int socket = -1) : fd(socket) {}
 
-        std::cout << "Units: " << alive << " | "
-                  << "Attacking: " << attacking << " | "
-                  << "Moving: " << moving << std::endl;
+    bool connected() const { return fd >= 0; }
+
+    bool send(const BorderTraffic& traffic) {
+        uint32_t counts[3] = {
+            static_cast<uint32_t>(traffic.ghosts.size()),
+            static_cast<uint32_t>(traffic.migrants.size()),
+            static_cast<uint32_t>(traffic.hits.size())
+        };
+        return writeAll(counts, sizeof(counts)) && writeArray(traffic.ghosts)
+            && writeArray(traffic.migrants) && writeArray(traffic.hits);
+    }
+
+    bool receive(BorderTraffic& traffic) {
+        uint32_t counts[3];
+        return readAll(counts, sizeof(counts)) && readArray(traffic.ghosts, counts[0])
+            && readArray(traffic.migrants, counts[1]) && readArray(traffic.hits, counts[2]);
+    }
+
+    void close() {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
     }
 };
 
-int main() {
-    std::srand(static_cast<unsigned>(std::time(nullptr)));
-    BattleSimulation battle;
+// 和左右邻居交换边界数据。每条连接上左边的分片先发后收、右边的先收后发，
+// 整条链从左往右依次推进，消息再大也不会两端同时堵在write上
+bool exchangeBorders(ShardLink links[2], BorderTraffic out[2], BorderTraffic in[2]) {
+    in[0].clear();
+    in[1].clear();
+    if (links[0].connected() && (!links[0].receive(in[0]) || !links[0].send(out[0]))) return false;
+    if (links[1].connected() && (!links[1].send(out[1]) || !links[1].receive(in[1]))) return false;
+    return true;
+}
+
+// 分片进程结束时通过管道交给父进程的汇总，小于PIPE_BUF，多个子进程同时写也不会交错
+struct ShardReport {
+    uint32_t shard;
+    int frames;
+    uint64_t alive;
+    uint64_t aliveByTeam[MAX_TEAMS];
+    uint64_t ghosts;
+    uint64_t migratedIn;
+    uint64_t migratedOut;
+    int64_t damage;
+    double seconds;
+};
+
+struct ShardOptions {
+    unsigned shards;
+    size_t unitsPerShard;
+    int frames;
+    float deltaTime;
+    uint64_t seed;
+    size_t teams;
+
+    ShardOptions()
+        : shards(2), unitsPerShard(20000), frames(600), deltaTime(0.016f), seed(1), teams(2) {}
+};
+
+// 子进程里跑一个分片：x方向切成等宽的条带，每帧模拟完和邻居交换边界
+int runShard(unsigned index, const ShardOptions& options, ShardLink links[2], int reportFd) {
+    float width = WORLD_SIZE / options.shards;
+    ShardBounds bounds;
+    bounds.minX = index * width;
+    bounds.maxX = index + 1 == options.shards ? WORLD_SIZE : (index + 1) * width;
+    bounds.hasNeighbor[0] = links[0].connected();
+    bounds.hasNeighbor[1] = links[1].connected();
+
+    std::unique_ptr<BattleSimulation> battle(new BattleSimulation(options.seed + index, options.teams));
+    battle->setShardBounds(bounds);
+    battle->setSpawnRegion(bounds.minX, 0, bounds.maxX - bounds.minX, WORLD_SIZE);
+    battle->spawnUnits(options.unitsPerShard);
+
+    BorderTraffic out[2];
+    BorderTraffic in[2];
+    auto start = std::chrono::steady_clock::now();
+    int frame = 0;
+    for (; frame < options.frames; ++frame) {
+        battle->simulateBattle(options.deltaTime);
+        battle->collectBorderTraffic(out);
+        if (!exchangeBorders(links, out, in)) {
+            std::cerr << "[shard " << index << "] lost neighbor at frame " << frame << std::endl;
+            break;
+        }
+        battle->applyBorderTraffic(0, in[0]);
+        battle->applyBorderTraffic(1, in[1]);
+
+        if (frame % 120 == 0) {
+            std::cout << "[shard " << index << "] frame " << frame
+                      << " alive " << battle->battleStats().alive()
+                      << " ghosts " << battle->ghostCount()
+                      << " migrated in/out " << battle->migratedInCount() << "/" << battle->migratedOutCount()
+                      << std::endl;
+        }
+    }
+
+    const BattleStats& stats = battle->battleStats();
+    ShardReport report{};
+    report.shard = index;
+    report.frames = frame;
+    report.alive = stats.alive();
+    for (size_t t = 0; t < MAX_TEAMS; ++t) report.aliveByTeam[t] = stats.aliveByTeam(t);
+    report.ghosts = battle->ghostCount();
+    report.migratedIn = battle->migratedInCount();
+    report.migratedOut = battle->migratedOutCount();
+    for (int t = 0; t < 3; ++t) report.damage += stats.damageDealt(static_cast<DamageType>(t));
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return ::write(reportFd, &report, sizeof(report)) == sizeof(report) ? 0 : 1;
+}
+
+// --shards N [--units 每分片单位数] [--frames F] [--seed S] [--teams T]
+// 在本机起N个进程，相邻分片之间用socketpair交换影子、迁移单位和命中
+int runShards(int argc, char** argv) {
+    ShardOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--shards" && hasValue) options.shards = std::stoul(argv[++i]);
+        else if (arg == "--units" && hasValue) options.unitsPerShard = std::stoul(argv[++i]);
+        else if (arg == "--frames" && hasValue) options.frames = std::stoi(argv[++i]);
+        else if (arg == "--seed" && hasValue) options.seed = std::stoull(argv[++i]);
+        else if (arg == "--teams" && hasValue) options.teams = std::stoul(argv[++i]);
+    }
+    if (options.shards == 0) options.shards = 1;
+
+    // links[i]连接分片i和i+1：[0]端给i，[1]端给i+1
+    std::vector<std::array<int, 2>> links(options.shards - 1);
+    for (auto& pair : links) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair.data()) != 0) {
+            std::cerr << "socketpair failed" << std::endl;
+            return 1;
+        }
+    }
+    int reportPipe[2];
+    if (pipe(reportPipe) != 0) {
+        std::cerr << "pipe failed" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Running " << options.shards << " shards x " << options.unitsPerShard << " units" << std::endl;
+    std::cout.flush();
+    std::vector<pid_t> children;
+    for (unsigned k = 0; k < options.shards; ++k) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            std::cerr << "fork failed" << std::endl;
+            break;
+        }
+        if (pid == 0) {
+            ShardLink own[2] = {
+                ShardLink(k > 0 ? links[k - 1][1] : -1),
+                ShardLink(k + 1 < options.shards ? links[k][0] : -1)
+            };
+            for (unsigned l = 0; l < links.size(); ++l) {
+                if (l + 1 != k) ::close(links[l][1]);
+                if (l != k) ::close(links[l][0]);
+            }
+            ::close(reportPipe[0]);
+            int code = runShard(k, options, own, reportPipe[1]);
+            own[0].close();
+            own[1].close();
+            std::cout.flush();
+            _exit(code);
+        }
+        children.push_back(pid);
+    }
+    for (auto& pair : links) {
+        ::close(pair[0]);
+        ::close(pair[1]);
+    }
+    ::close(reportPipe[1]);
+
+    std::vector<ShardReport> reports;
+    ShardReport report;
+    while (::read(reportPipe[0], &report, sizeof(report)) == sizeof(report)) reports.push_back(report);
+    ::close(reportPipe[0]);
+    for (pid_t pid : children) waitpid(pid, nullptr, 0);
+
+    std::sort(reports.begin(), reports.end(),
+              [](const ShardReport& a, const ShardReport& b) { return a.shard < b.shard; });
+    uint64_t alive = 0;
+    uint64_t byTeam[MAX_TEAMS] = {};
+    for (const ShardReport& r : reports) {
+        std::cout << "Shard " << r.shard << ": " << r.frames << " frames in " << r.seconds << " s, alive "
+                  << r.alive << ", ghosts " << r.ghosts << ", migrated in/out "
+                  << r.migratedIn << "/" << r.migratedOut << ", damage " << r.damage << std::endl;
+        alive += r.alive;
+        for (size_t t = 0; t < MAX_TEAMS; ++t) byTeam[t] += r.aliveByTeam[t];
+    }
+    std::cout << "Total alive: " << alive << " (teams";
+    for (size_t t = 0; t < std::clamp<size_t>(options.teams, 2, MAX_TEAMS); ++t) std::cout << " " << byTeam[t];
+    std::cout << ")" << std::endl;
+    return reports.size() == options.shards ? 0 : 1;
+}
+
+// fastmath对照libm：最大误差、8路结果是否和单值版本逐位一致、吞吐
+// 用法: --bench-math [--count N] [--seed S]
+int runBenchMath(int argc, char** argv) {
+    size_t count = 1 << 20;
+    uint64_t seed = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--count" && hasValue) count = std::stoul(argv[++i]);
+        else if (arg == "--seed" && hasValue) seed = std::stoull(argv[++i]);
+    }
+    count = std::max<size_t>(FAST_MATH_LANES, count / FAST_MATH_LANES * FAST_MATH_LANES);
+
+    Random rng(seed);
+    std::vector<float> a(count), b(count), out(count), out2(count), scalar(count);
+    auto fill = [&rng](std::vector<float>& v, float lo, float hi) {
+        for (float& x : v) x = lo + rng.uniform() * (hi - lo);
+    };
+    auto seconds = [](auto&& loop) {
+        auto start = std::chrono::steady_clock::now();
+        loop();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    auto report = [count](const char* name, const char* errorKind, double maxError, double bound,
+                          bool lanesMatch, double libmSeconds, double fastSeconds) {
+        std::cout << name << ": max " << errorKind << " error " << maxError << " (bound " << bound << ")"
+                  << (maxError <= bound ? "" : " EXCEEDED")
+                  << ", 8-lane " << (lanesMatch ? "matches" : "DIFFERS FROM") << " scalar"
+                  << " | libm " << libmSeconds * 1e9 / count << " ns, fast "
+                  << fastSeconds * 1e9 / count << " ns per value (x" << libmSeconds / fastSeconds << ")" << std::endl;
+        return maxError <= bound && lanesMatch;
+    };
+    // 结果都累加进sink打印出来，防止计时的循环被优化掉
+    double sink = 0;
+    bool ok = true;
+
+    // atan2，绝对误差(弧度)
+    {
+        fill(a, -WORLD_SIZE, WORLD_SIZE);
+        fill(b, -WORLD_SIZE, WORLD_SIZE);
+        double libm = seconds([&] { for (size_t i = 0; i < count; ++i) out[i] = std::atan2(a[i], b[i]); });
+        double fast = seconds([&] { for (size_t i = 0; i < count; i += FAST_MATH_LANES) fastAtan2x8(&a[i], &b[i], &out2[i]); });
+        double maxError = 0;
+        bool match = true;
+        for (size_t i = 0; i < count; ++i) {
+            scalar[i] = fastAtan2(a[i], b[i]);
+            match = match && scalar[i] == out2[i];
+            maxError = std::max(maxError, std::abs(out2[i] - std::atan2(static_cast<double>(a[i]), static_cast<double>(b[i]))));
+            sink += out[i] + out2[i];
+        }
+        ok = report("atan2 ", "absolute", maxError, 2e-5, match, libm, fast) && ok;
+    }
+
+    // sincos，绝对误差，sin和cos取较大者
+    {
+        fill(a, -1e5f, 1e5f);
+        double libm = seconds([&] {
+            for (size_t i = 0; i < count; ++i) {
+                out[i] = std::sin(a[i]);
+                b[i] = std::cos(a[i]);
+            }
+        });
+        double fast = seconds([&] { for (size_t i = 0; i < count; i += FAST_MATH_LANES) fastSinCos8(&a[i], &out2[i], &scalar[i]); });
+        double maxError = 0;
+        bool match = true;
+        for (size_t i = 0; i < count; ++i) {
+            float s, c;
+            fastSinCos(a[i], s, c);
+            match = match && s == out2[i] && c == scalar[i];
+            double angle = a[i];
+            maxError = std::max(maxError, std::max(std::abs(out2[i] - std::sin(angle)), std::abs(scalar[i] - std::cos(angle))));
+            sink += out[i] + b[i] + out2[i] + scalar[i];
+        }
+        ok = report("sincos", "absolute", maxError, 2e-6, match, libm, fast) && ok;
+    }
 
-    battle.spawnUnits(100000);
+    std::cout << "checksum " << sink << std::endl;
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    std::string shmName;
+    std::string telemetryPath;
+    // 组件列的分配策略对所有模式都生效，要在建任何BattleSimulation之前设好
+    // --no-huge-pages 只用普通页
+    ColumnAllocator::Policy columnPolicy{true};
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--no-huge-pages") columnPolicy.hugePages = false;
+    }
+    ColumnAllocator::setPolicy(columnPolicy);
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--batch") return runBatch(argc, argv);
+        if (arg == "--shards") return runShards(argc, argv);
+        if (arg == "--what-if") return runWhatIf(argc, argv);
+        if (arg == "--stream") return runStreaming(argc, argv);
+        if (arg == "--bench-math") return runBenchMath(argc, argv);
+        // --export-shm [name]：导出到共享内存，配合shm_reader查看
+        if (arg == "--export-shm") {
+            shmName = (i + 1 < argc && argv[i + 1][0] == '/') ? argv[++i] : SHM_WORLD_DEFAULT_NAME;
+        }
+        // --telemetry [path]：在Unix域套接字上提供指标快照
+        if (arg == "--telemetry") {
+            telemetryPath = (i + 1 < argc && argv[i + 1][0] == '/') ? argv[++i] : TELEMETRY_DEFAULT_PATH;
+        }
+    }
+
+    BattleSimulation battle(static_cast<uint64_t>(std::time(nullptr)), 4);
+    if (!shmName.empty()) {
+        if (battle.enableSharedMemoryExport(shmName)) std::cout << "Exporting world to " << shmName << std::endl;
+        else std::cerr << "Cannot create shared memory segment " << shmName << std::endl;
+    }
+    if (!telemetryPath.empty()) {
+        if (battle.enableTelemetry(telemetryPath)) std::cout << "Telemetry listening on " << telemetryPath << std::endl;
+        else std::cerr << "Cannot bind telemetry socket " << telemetryPath << std::endl;
+    }
+
+    battle.spawnUnits(95000);
+    battle.spawnScriptedUnits(5000);
+    battle.addInterestPoint(WORLD_SIZE * 0.5f, WORLD_SIZE * 0.5f);
+    battle.setAIBudget(2000); // AI每帧最多2ms
     std::cout << "Units spawned: " << battle.unitCount() << std::endl;
+    std::cout << "Component columns:";
+    for (size_t b = 0; b < static_cast<size_t>(PageBacking::COUNT); ++b) {
+        std::cout << " " << PAGE_BACKING_NAMES[b] << " " << ColumnAllocator::columns(static_cast<PageBacking>(b));
+    }
+    std::cout << std::endl;
 
-    const float deltaTime = 0.016f; // 60 FPS
-    for (int i = 0; i < 1000; ++i) {
-        battle.simulateBattle(deltaTime);
+    // 观察线程读帧快照做汇总，不会拖住模拟线程
+    SnapshotPublisher* snapshots = battle.enableSnapshots();
+    GameLoop loop(&battle, 1.0f / 60, 5); // 60 FPS，一轮最多补5步
+    std::atomic<bool> running{true};
+    std::thread observer([snapshots, &loop, &running] {
+        uint64_t lastFrame = 0;
+        while (running.load(std::memory_order_relaxed)) {
+            WorldSnapshot view;
+            if (snapshots->latest(view) && view.header->frame / 120 != lastFrame / 120) {
+                lastFrame = view.header->frame;
+                double cx = 0, cy = 0;
+                int64_t hp = 0;
+                for (uint32_t i = 0; i < view.header->count; ++i) {
+                    cx += view.x[i];
+                    cy += view.y[i];
+                    hp += view.health[i];
+                }
+                uint32_t n = view.header->count ? view.header->count : 1;
+                std::cout << "[observer] frame " << view.header->frame << " t=" << view.header->elapsed
+                          << "s (alpha " << loop.interpolationAlpha() << "): " << view.header->count << " units, centroid (" << cx / n << ", " << cy / n
+                          << "), total HP " << hp << std::endl;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    });
 
-        if (i % 60 == 0) { // 每秒显示一次
-            std::cout << "Frame " << i << " - ";
+    uint64_t nextReport = 0;
+    while (loop.steps() < 1000 && battle.unitCount() >= 100) {
+        loop.tick();
+        if (loop.steps() > nextReport) { // 每秒显示一次
+            std::cout << "Frame " << loop.steps() << " - ";
             battle.printBattleStatus();
+            nextReport += 60;
         }
-
-        if (battle.unitCount() < 100) break;
+        loop.waitForNextStep();
     }
+    running = false;
+    observer.join();
+
+    loop.stepHistogram().print("Step time");
+    loop.tickHistogram().print("Tick interval");
+    std::cout << "Dropped " << loop.droppedTime() << " s of simulation time to stay real-time" << std::endl;
 
     std::cout << "Battle simulation completed" << std::endl;
     return 0;
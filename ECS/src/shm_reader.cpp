@@ -0,0 +1,68 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+#include "shm_world.h"
+
+// 共享内存导出的示例消费者：只读映射模拟进程的段，定时采样打印各队存活人数和状态分布
+// 用法: shm_reader [/segment] [samples] [interval_ms]
+const char* STATE_NAMES[] = {"idle", "moving", "attacking", "dead"};
+const int MAX_SAMPLED_TEAMS = 8;
+
+int main(int argc, char** argv) {
+    std::string name = argc > 1 ? argv[1] : SHM_WORLD_DEFAULT_NAME;
+    int samples = argc > 2 ? std::stoi(argv[2]) : 20;
+    int intervalMs = argc > 3 ? std::stoi(argv[3]) : 500;
+
+    ShmWorldReader reader;
+    while (!reader.open(name.c_str())) {
+        std::cout << "Waiting for segment " << name << "..." << std::endl;
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    std::cout << "Mapped " << name << " (capacity " << reader.capacity() << ")" << std::endl;
+
+    uint64_t lastFrame = 0;
+    for (int s = 0; s < samples; ++s) {
+        uint64_t frame = 0;
+        float elapsed = 0;
+        uint32_t count = 0;
+        uint32_t byState[4];
+        uint32_t byTeam[MAX_SAMPLED_TEAMS];
+        double healthSum = 0;
+
+        bool consistent = reader.sample([&](const ShmWorldView& view) {
+            // 被写者打断时会重新调用，所以每次都从零开始
+            frame = view.frame;
+            elapsed = view.elapsed;
+            count = view.count;
+            healthSum = 0;
+            for (uint32_t& n : byState) n = 0;
+            for (uint32_t& n : byTeam) n = 0;
+            for (uint32_t i = 0; i < view.count; ++i) {
+                if (view.state[i] < 4) byState[view.state[i]]++;
+                if (view.team[i] < MAX_SAMPLED_TEAMS) byTeam[view.team[i]]++;
+                healthSum += view.health[i];
+            }
+        });
+
+        if (!consistent) {
+            std::cout << "Sample " << s << ": writer busy, skipped" << std::endl;
+        } else if (frame == lastFrame) {
+            std::cout << "Sample " << s << ": no new frame" << std::endl;
+        } else {
+            lastFrame = frame;
+            std::cout << "Frame " << frame << " t=" << elapsed << "s units " << count
+                      << " | avg HP " << (count ? healthSum / count : 0) << " |";
+            for (int st = 0; st < 4; ++st) std::cout << " " << STATE_NAMES[st] << " " << byState[st];
+            std::cout << " | teams";
+            for (int t = 0; t < MAX_SAMPLED_TEAMS; ++t) {
+                if (byTeam[t]) std::cout << " " << t << ":" << byTeam[t];
+            }
+            std::cout << std::endl;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+    }
+    return 0;
+}